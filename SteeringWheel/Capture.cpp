@@ -0,0 +1,120 @@
+#include "Capture.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <algorithm>
+
+Capture::Capture() : axisCount(0), buttonCount(0), hatCount(0), ticks(0), eventCount(0)
+{
+}
+
+void Capture::configure(int axisTotal, int buttonTotal, int hatTotal)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	axisCount = std::min(std::max(axisTotal, 0), CAPTURE_AXES);
+	buttonCount = std::min(std::max(buttonTotal, 0), CAPTURE_BUTTONS);
+	hatCount = std::min(std::max(hatTotal, 0), CAPTURE_HATS);
+	ticks = 0;
+	eventCount = 0;
+}
+
+int Capture::getAxisCount() const
+{
+	return axisCount;
+}
+
+int Capture::getButtonCount() const
+{
+	return buttonCount;
+}
+
+int Capture::getHatCount() const
+{
+	return hatCount;
+}
+
+void Capture::record(Uint64 time, const Sint16* axisValues, Uint32 buttonBits, const Uint8* hatValues)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	// Edges against the previous tick
+	Uint32 changed = ticks > 0 ? buttonBits ^ buttons[(ticks - 1) & (CAPTURE_HISTORY - 1)] : buttonBits;
+	for (; changed != 0; changed &= changed - 1)
+	{
+		Uint8 button = 0;
+		while (!((changed >> button) & 1)) ++button;
+		events[eventCount++ & (CAPTURE_EVENTS - 1)] = { time, button, ((buttonBits >> button) & 1) != 0 };
+	}
+
+	Uint32 slot = ticks & (CAPTURE_HISTORY - 1);
+	times[slot] = time;
+	for (int a = 0; a < axisCount; ++a) axes[a][slot] = axisValues[a];
+	buttons[slot] = buttonBits;
+	for (int h = 0; h < hatCount; ++h) hats[h][slot] = hatValues[h];
+	++ticks;
+}
+
+void Capture::fill(Uint64 tick, CaptureSnapshot& snapshot) const
+{
+	Uint32 slot = tick & (CAPTURE_HISTORY - 1);
+	snapshot.tick = tick;
+	snapshot.time = times[slot];
+	for (int a = 0; a < CAPTURE_AXES; ++a) snapshot.axes[a] = a < axisCount ? axes[a][slot] : 0;
+	snapshot.buttons = buttons[slot];
+	for (int h = 0; h < CAPTURE_HATS; ++h) snapshot.hats[h] = h < hatCount ? hats[h][slot] : SDL_HAT_CENTERED;
+}
+
+Uint64 Capture::getTicks() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return ticks;
+}
+
+bool Capture::latest(CaptureSnapshot& snapshot) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (ticks == 0) return false;
+	fill(ticks - 1, snapshot);
+	return true;
+}
+
+bool Capture::at(Uint64 tick, CaptureSnapshot& snapshot) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (tick >= ticks || ticks - tick > CAPTURE_HISTORY) return false;
+	fill(tick, snapshot);
+	return true;
+}
+
+size_t Capture::history(int axis, Sint16* values, Uint64* valueTimes, size_t count) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (axis < 0 || axis >= axisCount) return 0;
+
+	count = (size_t)std::min<Uint64>(count, std::min<Uint64>(ticks, CAPTURE_HISTORY));
+	Uint64 first = ticks - count;
+	for (size_t i = 0; i < count; ++i)
+	{
+		Uint32 slot = (first + i) & (CAPTURE_HISTORY - 1);
+		values[i] = axes[axis][slot];
+		if (valueTimes != nullptr) valueTimes[i] = times[slot];
+	}
+	return count;
+}
+
+size_t Capture::buttonEvents(Uint64& cursor, ButtonEvent* out, size_t max) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (eventCount - std::min(cursor, eventCount) > CAPTURE_EVENTS) cursor = eventCount - CAPTURE_EVENTS;
+	if (cursor > eventCount) cursor = eventCount;
+
+	size_t n = 0;
+	for (; cursor < eventCount && n < max; ++cursor, ++n) out[n] = events[cursor & (CAPTURE_EVENTS - 1)];
+	return n;
+}
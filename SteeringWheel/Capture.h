@@ -0,0 +1,93 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <mutex>
+
+/*
+   Whole device snapshots taken by the sampler.
+
+   Each sample tick reads every axis, button and hat after the same
+   SDL_JoystickUpdate() so the pedals, shifter and wheel are all from
+   one moment and share one timestamp. Ticks are kept in ring buffers
+   with an array per axis, so the history of one pedal is read without
+   touching the others. Button changes are also queued as edge events -
+   each consumer keeps its own cursor into them.
+*/
+
+constexpr auto CAPTURE_AXES = 8;
+constexpr auto CAPTURE_BUTTONS = 32; // one bit each
+constexpr auto CAPTURE_HATS = 4;
+constexpr Uint32 CAPTURE_HISTORY = 1024; // ticks kept - power of 2
+constexpr Uint32 CAPTURE_EVENTS = 256; // button events kept - power of 2
+
+// G27 axes with separate pedals
+constexpr auto AXIS_WHEEL = 0;
+constexpr auto AXIS_THROTTLE = 1;
+constexpr auto AXIS_BRAKE = 2;
+constexpr auto AXIS_CLUTCH = 3;
+
+struct CaptureSnapshot
+{
+	Uint64 tick = 0;		// sample number
+	Uint64 time = 0;		// nS, same clock as clockNow()
+	Sint16 axes[CAPTURE_AXES] = {};
+	Uint32 buttons = 0;		// bit n set while button n is down
+	Uint8 hats[CAPTURE_HATS] = {}; // SDL_HAT_*
+};
+
+struct ButtonEvent
+{
+	Uint64 time;			// nS of the tick it was seen in
+	Uint8 button;
+	bool pressed;			// false when released
+};
+
+class Capture
+{
+private:
+	mutable std::mutex lock; // sampler writes, anyone reads
+	int axisCount, buttonCount, hatCount;
+
+	// Ring of ticks - one array per field
+	Uint64 times[CAPTURE_HISTORY];
+	Sint16 axes[CAPTURE_AXES][CAPTURE_HISTORY];
+	Uint32 buttons[CAPTURE_HISTORY];
+	Uint8 hats[CAPTURE_HATS][CAPTURE_HISTORY];
+	Uint64 ticks; // written so far
+
+	ButtonEvent events[CAPTURE_EVENTS];
+	Uint64 eventCount; // queued so far
+
+	void fill(Uint64 tick, CaptureSnapshot& snapshot) const;
+
+public:
+	Capture();
+
+	// Counts the device reports - extra are ignored
+	void configure(int axes, int buttons, int hats);
+	int getAxisCount() const;
+	int getButtonCount() const;
+	int getHatCount() const;
+
+	// Sampler only
+	void record(Uint64 time, const Sint16* axisValues, Uint32 buttonBits, const Uint8* hatValues);
+
+	Uint64 getTicks() const;
+	bool latest(CaptureSnapshot& snapshot) const;
+	bool at(Uint64 tick, CaptureSnapshot& snapshot) const; // false once overwritten
+
+	// Newest count values of one axis, oldest first - returns how many
+	size_t history(int axis, Sint16* values, Uint64* valueTimes, size_t count) const;
+
+	// Events after cursor, which is moved on. A cursor that has fallen
+	// more than CAPTURE_EVENTS behind skips to the oldest kept.
+	size_t buttonEvents(Uint64& cursor, ButtonEvent* out, size_t max) const;
+};
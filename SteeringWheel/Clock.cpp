@@ -0,0 +1,179 @@
+#include "Clock.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <intrin.h>
+#pragma comment(lib, "winmm.lib") // timeBeginPeriod()
+#define CLOCK_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#define CLOCK_TSC
+#endif
+
+// Calibration - start is fixed, the anchor moves on every
+// CLOCK_REANCHOR so the rate is measured over an ever longer span
+struct ClockState
+{
+	bool tsc = false;
+	Uint64 startTicks = 0;
+	Uint64 startTime = 0;
+	Uint64 reanchorTicks = 0;
+	std::atomic<Uint32> sequence{ 0 }; // odd while the anchor is being moved
+	std::atomic<Uint64> baseTicks{ 0 };
+	std::atomic<Uint64> baseTime{ 0 };
+	std::atomic<double> nsPerTick{ 0.0 };
+	std::atomic<bool> updating{ false };
+};
+
+// TSC that ticks at a constant rate whatever the power state
+static bool invariantTsc()
+{
+#ifdef _WIN32
+	int regs[4];
+	__cpuid(regs, 0x80000000);
+	if ((unsigned int)regs[0] < 0x80000007) return false;
+	__cpuid(regs, 0x80000007);
+	return (regs[3] & (1 << 8)) != 0;
+#elif defined(CLOCK_TSC)
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+	if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007) return false;
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	return (edx & (1 << 8)) != 0;
+#else
+	return false;
+#endif
+}
+
+static Uint64 readTicks()
+{
+#ifdef CLOCK_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// Pair a TSC reading with the steady clock - the midpoint of two
+// clock reads either side keeps the pairing within a few tens of nS
+static void pairTicks(Uint64& ticks, Uint64& time)
+{
+	Uint64 before = clockNow();
+	ticks = readTicks();
+	Uint64 after = clockNow();
+	time = before + (after - before) / 2;
+}
+
+static void calibrate(ClockState& state)
+{
+#ifdef _WIN32
+	// Default scheduler tick is 15.6 mS - ask for 1 mS for the life of the process
+	timeBeginPeriod(1);
+#endif
+
+	if (!invariantTsc()) return;
+
+	Uint64 endTicks, endTime;
+	pairTicks(state.startTicks, state.startTime);
+	std::this_thread::sleep_for(std::chrono::milliseconds(CLOCK_CALIBRATION));
+	pairTicks(endTicks, endTime);
+	if (endTicks <= state.startTicks) return;
+
+	double nsPerTick = (double)(endTime - state.startTime) / (double)(endTicks - state.startTicks);
+	state.reanchorTicks = (Uint64)(CLOCK_REANCHOR * 1.0e6 / nsPerTick);
+	state.nsPerTick = nsPerTick;
+	state.baseTicks = endTicks;
+	state.baseTime = endTime;
+	state.tsc = true;
+}
+
+// Calibrated once, thread safe
+static ClockState& clockState()
+{
+	static ClockState state;
+	static bool calibrated = (calibrate(state), true);
+	(void)calibrated;
+	return state;
+}
+
+void clockInit()
+{
+	clockState();
+}
+
+Uint64 clockNow()
+{
+	using namespace std::chrono;
+	return (Uint64)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+Uint64 clockStamp()
+{
+	ClockState& state = clockState();
+	if (!state.tsc) return clockNow();
+
+	// Sequence lock read of the anchor
+	Uint64 ticks, time;
+	double nsPerTick;
+	Uint32 seq;
+	do
+	{
+		seq = state.sequence.load(std::memory_order_acquire);
+		ticks = state.baseTicks.load(std::memory_order_relaxed);
+		time = state.baseTime.load(std::memory_order_relaxed);
+		nsPerTick = state.nsPerTick.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((seq & 1) || state.sequence.load(std::memory_order_relaxed) != seq);
+
+	Uint64 now = readTicks();
+	if (now - ticks < state.reanchorTicks || state.updating.exchange(true))
+	{
+		return time + (Uint64)((Sint64)(now - ticks) * nsPerTick);
+	}
+
+	// Move the anchor - one caller at a time, the rest use the old one
+	pairTicks(ticks, time);
+	nsPerTick = (double)(time - state.startTime) / (double)(ticks - state.startTicks);
+	state.sequence.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	state.baseTicks.store(ticks, std::memory_order_relaxed);
+	state.baseTime.store(time, std::memory_order_relaxed);
+	state.nsPerTick.store(nsPerTick, std::memory_order_relaxed);
+	state.sequence.fetch_add(1, std::memory_order_release);
+	state.updating = false;
+	return time;
+}
+
+bool clockHasTsc()
+{
+	return clockState().tsc;
+}
+
+void sleepUntil(Uint64 deadline, Uint32 spinUs)
+{
+	clockState(); // timer resolution on Windows
+
+	Uint64 wake = deadline - spinUs * NS_PER_US;
+	Uint64 now = clockNow();
+	if (deadline > spinUs * NS_PER_US && now < wake) std::this_thread::sleep_for(std::chrono::nanoseconds(wake - now));
+	while (clockNow() < deadline) {}
+}
+
+void sleepFor(Uint64 nS, Uint32 spinUs)
+{
+	sleepUntil(clockNow() + nS, spinUs);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+
+/*
+   Timing for the whole library.
+
+   clockNow() is the steady clock in nS - system wide (QPC on Windows,
+   CLOCK_MONOTONIC on Linux) so other processes can compare stamps.
+   clockStamp() is the same time base read from the CPU time stamp
+   counter when it is invariant - cheaper, used to stamp samples. The
+   TSC rate is re-measured every CLOCK_REANCHOR so the two stay within
+   a uS or so of each other.
+   Sleeps go to the OS until CLOCK_SPIN before the deadline and spin
+   the rest, so they land within a few uS rather than a scheduler tick.
+*/
+
+constexpr Uint32 CLOCK_SPIN = 2000; // uS spun at the end of a sleep
+constexpr Uint32 CLOCK_CALIBRATION = 20; // mS spent timing the TSC
+constexpr Uint32 CLOCK_REANCHOR = 1000; // mS between TSC re-calibrations
+constexpr Uint64 NS_PER_US = 1000;
+constexpr Uint64 NS_PER_MS = 1000000;
+
+// Calibrate up front rather than on first use
+void clockInit();
+
+// nS on the steady clock
+Uint64 clockNow();
+
+// nS on the steady clock's time base, from the TSC when available
+Uint64 clockStamp();
+bool clockHasTsc();
+
+// Sleep then spin - spinUs 0 for a plain sleep
+void sleepUntil(Uint64 deadline, Uint32 spinUs = CLOCK_SPIN);
+void sleepFor(Uint64 nS, Uint32 spinUs = CLOCK_SPIN);
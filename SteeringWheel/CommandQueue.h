@@ -0,0 +1,101 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+/*
+   Bounded queue for many producers and one consumer.
+
+   Any thread can push without taking a lock - each slot has a sequence
+   number that says whether it is free, being filled or ready. Only the
+   command thread pops. Push fails when the queue is full rather than
+   waiting, so a producer never blocks on the device.
+
+   Size must be a power of 2.
+*/
+
+constexpr size_t COMMAND_QUEUE_SIZE = 1024;
+
+template <typename T, size_t Size = COMMAND_QUEUE_SIZE>
+class CommandQueue
+{
+public:
+	CommandQueue() : tail(0), head(0)
+	{
+		static_assert(Size >= 2 && (Size & (Size - 1)) == 0, "CommandQueue size must be a power of 2");
+		for (size_t i = 0; i < Size; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	CommandQueue(const CommandQueue&) = delete;
+	CommandQueue& operator=(const CommandQueue&) = delete;
+
+	// Any thread - false when full
+	bool push(T&& value)
+	{
+		size_t pos = tail.load(std::memory_order_relaxed);
+		Cell* cell;
+		while (true)
+		{
+			cell = &cells[pos & (Size - 1)];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+			if (diff == 0)
+			{
+				// Slot free - claim it
+				if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+			}
+			else if (diff < 0) return false; // consumer hasn't freed it - full
+			else pos = tail.load(std::memory_order_relaxed); // another producer took it
+		}
+
+		cell->value = std::move(value);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer thread only - false when empty
+	bool pop(T& value)
+	{
+		size_t pos = head.load(std::memory_order_relaxed);
+		Cell& cell = cells[pos & (Size - 1)];
+		size_t seq = cell.sequence.load(std::memory_order_acquire);
+		if ((std::ptrdiff_t)seq - (std::ptrdiff_t)(pos + 1) < 0) return false;
+
+		value = std::move(cell.value);
+		cell.value = T();
+		head.store(pos + 1, std::memory_order_relaxed);
+		cell.sequence.store(pos + Size, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer thread only - a push in progress counts as empty until it finishes
+	bool empty() const
+	{
+		size_t pos = head.load(std::memory_order_relaxed);
+		return cells[pos & (Size - 1)].sequence.load(std::memory_order_acquire) != pos + 1;
+	}
+
+	size_t capacity() const { return Size; }
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	// Apart so producers and the consumer don't share a cache line
+	alignas(64) Cell cells[Size];
+	alignas(64) std::atomic<size_t> tail;
+	alignas(64) std::atomic<size_t> head;
+};
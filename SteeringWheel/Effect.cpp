@@ -0,0 +1,81 @@
+#include "Effect.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <cstring>
+
+void EffectDescriptor::fill(SDL_HapticEffect& e) const
+{
+	memset(&e, 0, sizeof(SDL_HapticEffect));
+	e.type = type;
+
+	switch (type)
+	{
+	case SDL_HAPTIC_CONSTANT:
+		e.constant.direction.type = DIRECTION_TYPE;
+		e.constant.direction.dir[0] = dir[0];
+		e.constant.length = length;
+		e.constant.delay = delay;
+		e.constant.level = level;
+		e.constant.attack_length = attackLength;
+		e.constant.attack_level = attackLevel;
+		e.constant.fade_length = fadeLength;
+		e.constant.fade_level = fadeLevel;
+		break;
+	case SDL_HAPTIC_SINE:
+	case SDL_HAPTIC_TRIANGLE:
+	case SDL_HAPTIC_SAWTOOTHUP:
+	case SDL_HAPTIC_SAWTOOTHDOWN:
+		e.periodic.direction.type = DIRECTION_TYPE;
+		e.periodic.direction.dir[0] = dir[0];
+		e.periodic.direction.dir[1] = dir[1];
+		e.periodic.length = length;
+		e.periodic.delay = delay;
+		e.periodic.period = period;
+		e.periodic.magnitude = magnitude;
+		e.periodic.offset = offset;
+		e.periodic.phase = phase;
+		e.periodic.attack_length = attackLength;
+		e.periodic.attack_level = attackLevel;
+		e.periodic.fade_length = fadeLength;
+		e.periodic.fade_level = fadeLevel;
+		break;
+	case SDL_HAPTIC_SPRING:
+	case SDL_HAPTIC_DAMPER:
+	case SDL_HAPTIC_INERTIA:
+	case SDL_HAPTIC_FRICTION:
+		e.condition.direction.type = DIRECTION_TYPE;
+		e.condition.length = length;
+		e.condition.delay = delay;
+		// Same for all 3 axis
+		for (int axis = 0; axis < 3; axis++)
+		{
+			e.condition.right_sat[axis] = rightSat;
+			e.condition.left_sat[axis] = leftSat;
+			e.condition.right_coeff[axis] = rightCoeff;
+			e.condition.left_coeff[axis] = leftCoeff;
+			e.condition.deadband[axis] = deadband;
+			e.condition.center[axis] = centre;
+		}
+		break;
+	case SDL_HAPTIC_RAMP:
+		e.ramp.direction.type = DIRECTION_TYPE;
+		e.ramp.direction.dir[0] = dir[0];
+		e.ramp.direction.dir[1] = dir[1];
+		e.ramp.length = length;
+		e.ramp.delay = delay;
+		e.ramp.start = start;
+		e.ramp.end = end;
+		e.ramp.attack_length = attackLength;
+		e.ramp.attack_level = attackLevel;
+		e.ramp.fade_length = fadeLength;
+		e.ramp.fade_level = fadeLevel;
+		break;
+	}
+}
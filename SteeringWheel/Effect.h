@@ -0,0 +1,161 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <type_traits>
+#include "Wheel.h"
+
+/*
+   Prebuilt effect descriptors.
+
+   The set*() calls check every argument, log what is wrong and pack
+   the result into an SDL_HapticEffect each time they are called. A
+   descriptor does that once when it is built - at compile time when
+   the values are constants:
+
+	constexpr EffectDescriptor bump = constantEffect(LEFT, 200, L20);
+	static_assert(bump.valid(), "bad effect");
+	wheel->setEffect(bump); // no checks, no logging
+
+   error holds the first thing wrong with it, nullptr when valid.
+   Levels above MAX would play reversed, so they are refused. Levels
+   are scaled by FORCE_SCALE when built. Device abilities are
+   not checked - the device refuses effects it can't play.
+*/
+
+struct EffectDescriptor
+{
+	unsigned int slot;		// effect number - LEFT, SINE, SPRING...
+	Uint16 type;			// SDL_HAPTIC_*
+	Sint32 dir[2];			// left_right, up_down
+	Uint32 length;			// mS
+	Uint16 delay;			// mS
+
+	Sint16 level;			// constant
+	Uint16 period;			// periodic, mS
+	Sint16 magnitude;
+	Sint16 offset;
+	Uint16 phase;
+	Sint16 start, end;		// ramp
+
+	Uint16 attackLength, attackLevel;
+	Uint16 fadeLength, fadeLevel;
+
+	Uint16 rightSat, leftSat; // condition
+	Sint16 rightCoeff, leftCoeff;
+	Uint16 deadband;
+	Sint16 centre;
+
+	const char* error;
+
+	constexpr bool valid() const { return error == nullptr; }
+
+	// Pack for SDL_HapticNewEffect / SDL_HapticUpdateEffect
+	void fill(SDL_HapticEffect& e) const;
+};
+
+static_assert(std::is_trivially_copyable<EffectDescriptor>::value, "EffectDescriptor is copied as plain bytes");
+
+constexpr Sint16 effectLevel(int lvl)
+{
+	return (Sint16)(Uint16)(lvl * FORCE_SCALE);
+}
+
+constexpr EffectDescriptor blankEffect(unsigned int slot, Uint16 type)
+{
+	return { slot, type, { 0, 0 }, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, nullptr };
+}
+
+// Same checks as the set*() calls
+constexpr const char* checkEffectTimes(Uint32 mS, Uint32 dly, Uint32 aLen, Uint32 fLen)
+{
+	if (mS < MIN_DURATION) return "duration in mS Out of Bounds";
+	if (dly > SDL_MAX_UINT16) return "delay in mS Out of Bounds";
+	if (aLen > SDL_MAX_UINT16) return "attack length in mS Out of Bounds";
+	if (fLen > SDL_MAX_UINT16) return "fade length in mS Out of Bounds";
+	if (aLen + fLen > mS) return "Attack + Fade length is greater than total duration";
+	return nullptr;
+}
+
+// LEFT or RIGHT
+constexpr EffectDescriptor constantEffect(unsigned int dir, Uint32 mS, Uint16 lvl, Uint32 dly = DEFAULT_DELAY,
+	Uint32 aLen = DEFAULT_ATTACK_TIME, Uint16 aLvl = DEFAULT_ATTACK_LVL, Uint32 fLen = DEFAULT_FADE_TIME, Uint16 fLvl = DEFAULT_FADE_LVL)
+{
+	EffectDescriptor d = blankEffect(dir, SDL_HAPTIC_CONSTANT);
+	if (dir != LEFT && dir != RIGHT) d.error = "Bad direction";
+	else if (lvl > MAX) d.error = "level Out of Bounds";
+	else d.error = checkEffectTimes(mS, dly, aLen, fLen);
+
+	d.dir[0] = dir == LEFT ? 1 : -1;
+	d.length = mS;
+	d.delay = (Uint16)dly;
+	d.level = effectLevel(lvl);
+	d.attackLength = (Uint16)aLen;
+	d.attackLevel = (Uint16)effectLevel(aLvl);
+	d.fadeLength = (Uint16)fLen;
+	d.fadeLevel = (Uint16)effectLevel(fLvl);
+	return d;
+}
+
+// SINE TRIANGLE SAWUP or SAWDOWN - as setSine() etc.
+constexpr EffectDescriptor periodicEffect(unsigned int type, Uint32 mS, Uint32 period, Uint16 lvl, unsigned int dir)
+{
+	// SAWDOWN is played as SAWTOOTHUP to match setPeriodType()
+	Uint16 sdlType = type == TRIANGLE ? SDL_HAPTIC_TRIANGLE : type == SAWUP || type == SAWDOWN ? SDL_HAPTIC_SAWTOOTHUP : SDL_HAPTIC_SINE;
+	EffectDescriptor d = blankEffect(type, sdlType);
+	if (type != SINE && type != TRIANGLE && type != SAWUP && type != SAWDOWN) d.error = "Period type not known";
+	else if (dir != LEFT && dir != RIGHT && dir != UP && dir != DOWN) d.error = "Bad direction";
+	else if (period > SDL_MAX_UINT16) d.error = "period in mS Out of Bounds";
+	else if (lvl > MAX) d.error = "level Out of Bounds";
+	else d.error = checkEffectTimes(mS, 0, 0, 0);
+
+	d.dir[0] = dir == LEFT ? 1 : dir == RIGHT ? -1 : 0;
+	d.dir[1] = dir == UP ? 1 : dir == DOWN ? -1 : 0;
+	d.length = mS;
+	d.period = (Uint16)period;
+	d.magnitude = effectLevel(lvl);
+	// TODO cludge as setPeriod() - offset only works LEFT or RIGHT
+	if ((type == SINE || type == TRIANGLE) && (dir == LEFT || dir == RIGHT)) d.offset = effectLevel(lvl / 2);
+	return d;
+}
+
+// SPRING DAMPER INERTIA or FRICTION
+constexpr EffectDescriptor conditionEffect(unsigned int type, Uint32 mS, Uint32 dly, Uint16 rSat, Uint16 lSat, Sint16 rCo, Sint16 lCo, Uint16 dead = 0, Sint16 centre = 0)
+{
+	Uint16 sdlType = type == DAMPER ? SDL_HAPTIC_DAMPER : type == INERTIA ? SDL_HAPTIC_INERTIA : type == FRICTION ? SDL_HAPTIC_FRICTION : SDL_HAPTIC_SPRING;
+	EffectDescriptor d = blankEffect(type, sdlType);
+	if (type != SPRING && type != DAMPER && type != INERTIA && type != FRICTION) d.error = "Condition type not known";
+	else d.error = checkEffectTimes(mS, dly, 0, 0);
+
+	d.length = mS;
+	d.delay = (Uint16)dly;
+	d.rightSat = (Uint16)effectLevel(rSat);
+	d.leftSat = (Uint16)effectLevel(lSat);
+	d.rightCoeff = effectLevel((Uint16)rCo);
+	d.leftCoeff = effectLevel((Uint16)lCo);
+	d.deadband = dead;
+	d.centre = centre;
+	return d;
+}
+
+// RAMP_LEFT or RAMP_RIGHT
+constexpr EffectDescriptor rampEffect(unsigned int type, Uint32 mS, Sint16 start, Sint16 end)
+{
+	EffectDescriptor d = blankEffect(type, SDL_HAPTIC_RAMP);
+	if (type != RAMP_LEFT && type != RAMP_RIGHT) d.error = "Ramp type not known";
+	else if (mS == FOREVER) d.error = "Ramp duration can not be FOREVER";
+	else d.error = checkEffectTimes(mS, 0, 0, 0);
+
+	d.dir[0] = type == RAMP_LEFT ? 1 : -1;
+	d.length = mS;
+	d.start = effectLevel((Uint16)start);
+	d.end = effectLevel((Uint16)end);
+	return d;
+}
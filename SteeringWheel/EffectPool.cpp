@@ -0,0 +1,111 @@
+#include "EffectPool.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+EffectPool::EffectPool() : nextId(1), uses(0), capacity(DEFAULT_EFFECT_CAPACITY)
+{
+}
+
+void EffectPool::setCapacity(int slots)
+{
+	capacity = slots;
+}
+
+int EffectPool::getCapacity() const
+{
+	return capacity;
+}
+
+EffectHandle EffectPool::add(const SDL_HapticEffect& params)
+{
+	EffectInstance instance;
+	instance.params = params;
+	instance.deviceId = NOT_RESIDENT;
+	instance.lastUsed = ++uses;
+	instance.ends = 0;
+	instance.playing = false;
+	instance.pinned = false;
+	instance.drives = params.type != SDL_HAPTIC_SPRING && params.type != SDL_HAPTIC_DAMPER
+		&& params.type != SDL_HAPTIC_INERTIA && params.type != SDL_HAPTIC_FRICTION;
+
+	EffectHandle handle;
+	handle.id = nextId++;
+	instances[handle.id] = instance;
+	return handle;
+}
+
+EffectInstance* EffectPool::find(EffectHandle handle)
+{
+	auto found = instances.find(handle.id);
+	if (found == instances.end()) return nullptr;
+	found->second.lastUsed = ++uses;
+	return &found->second;
+}
+
+void EffectPool::remove(EffectHandle handle)
+{
+	instances.erase(handle.id);
+}
+
+void EffectPool::clear()
+{
+	instances.clear();
+}
+
+size_t EffectPool::size() const
+{
+	return instances.size();
+}
+
+int EffectPool::resident() const
+{
+	int count = 0;
+	for (const auto& i : instances) if (i.second.deviceId != NOT_RESIDENT) ++count;
+	return count;
+}
+
+bool EffectPool::isIdle(const EffectInstance& instance, Uint64 now) const
+{
+	return !instance.playing || (instance.ends != 0 && now >= instance.ends);
+}
+
+Uint32 EffectPool::victim(Uint64 now) const
+{
+	Uint32 oldest = 0;
+	Uint64 oldestUse = SDL_MAX_UINT64;
+	for (const auto& i : instances)
+	{
+		const EffectInstance& instance = i.second;
+		if (instance.deviceId == NOT_RESIDENT || instance.pinned || !isIdle(instance, now)) continue;
+		if (instance.lastUsed < oldestUse)
+		{
+			oldest = i.first;
+			oldestUse = instance.lastUsed;
+		}
+	}
+	return oldest;
+}
+
+Uint64 EffectPool::driveUntil(Uint64 now) const
+{
+	Uint64 until = 0;
+	for (const auto& i : instances)
+	{
+		const EffectInstance& instance = i.second;
+		if (!instance.drives || isIdle(instance, now)) continue;
+		if (instance.ends == 0) return SDL_MAX_UINT64;
+		if (instance.ends > until) until = instance.ends;
+	}
+	return until;
+}
+
+std::map<Uint32, EffectInstance>& EffectPool::all()
+{
+	return instances;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <map>
+
+/*
+   Effect instances behind handles.
+
+   The numbered effects (LEFT, SINE...) allow one of each. Handles
+   allow as many as the device has room for - two sines for engine
+   and kerb rumble, say - and keep them uploaded so running one
+   costs no upload. When the device is full the least recently used
+   instance that is not playing is removed from the device. Its
+   parameters are kept and it is uploaded again the next time it is
+   used.
+
+   The pool only keeps the books - the Wheel talks to the device.
+*/
+
+constexpr int DEFAULT_EFFECT_CAPACITY = 128; // G27 - used when replaying
+constexpr int NOT_RESIDENT = -1;
+
+struct EffectHandle
+{
+	Uint32 id = 0; // 0 = none
+	bool valid() const { return id != 0; }
+};
+
+struct EffectInstance
+{
+	SDL_HapticEffect params;
+	int deviceId;		// NOT_RESIDENT when not on the device
+	Uint64 lastUsed;	// use counter - lower is older
+	Uint64 ends;		// nS - end of the current run, 0 for ever
+	bool playing;
+	bool drives;		// pushes the wheel - conditions don't
+	bool pinned;		// never evicted - a prepared scene
+};
+
+class EffectPool
+{
+private:
+	std::map<Uint32, EffectInstance> instances;
+	Uint32 nextId;
+	Uint64 uses;
+	int capacity;
+
+public:
+	EffectPool();
+
+	void setCapacity(int slots);
+	int getCapacity() const;
+
+	EffectHandle add(const SDL_HapticEffect& params);
+	EffectInstance* find(EffectHandle handle); // marks it used - nullptr if released
+	void remove(EffectHandle handle);
+	void clear();
+
+	size_t size() const;
+	int resident() const;
+	bool isIdle(const EffectInstance& instance, Uint64 now) const;
+
+	// Least recently used resident instance that isn't playing or pinned - 0 if none
+	Uint32 victim(Uint64 now) const;
+
+	// Latest end of a playing instance that drives the wheel - 0 if none
+	Uint64 driveUntil(Uint64 now) const;
+
+	std::map<Uint32, EffectInstance>& all();
+};
@@ -0,0 +1,96 @@
+#include "EndStop.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <algorithm>
+#include <cmath>
+
+EndStops::EndStops() : left(-ENDSTOP_NONE), right(ENDSTOP_NONE), stiffness(ENDSTOP_STIFFNESS), hysteresis(ENDSTOP_HYSTERESIS),
+	maxLevel(ENDSTOP_MAX_LEVEL), enabled(false), engaged(0), lastSent(0), totalReaction(0)
+{
+}
+
+void EndStops::configure(float leftAngle, float rightAngle, float levelPerDegree, float hysteresisDegrees, Uint16 max)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	left = leftAngle;
+	right = rightAngle;
+	stiffness = levelPerDegree;
+	hysteresis = hysteresisDegrees;
+	maxLevel = max;
+	enabled = true;
+}
+
+void EndStops::disable()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	enabled = false;
+	engaged = 0;
+}
+
+bool EndStops::isEnabled() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return enabled;
+}
+
+bool EndStops::evaluate(float angle, float measured, int& level)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	level = 0;
+	if (enabled)
+	{
+		// Degrees past each wall - -ve while inside
+		float pastLeft = left - angle;
+		float pastRight = angle - right;
+
+		if (engaged == 0)
+		{
+			if (pastLeft >= 0.0f) engaged = -1;
+			else if (pastRight >= 0.0f) engaged = 1;
+			if (engaged != 0) stats.hits++;
+		}
+
+		float past = engaged < 0 ? pastLeft : pastRight;
+		if (engaged != 0 && past <= -hysteresis) engaged = 0;
+
+		float measuredPast = std::max(left - measured, measured - right);
+		if (measuredPast > stats.deepest) stats.deepest = measuredPast;
+
+		if (engaged != 0)
+		{
+
+			// Full stiffness at the wall, down to nothing hysteresis inside it
+			float force = std::min((past + hysteresis) * stiffness, (float)maxLevel);
+			level = engaged < 0 ? (int)force : -(int)force;
+		}
+	}
+
+	// Always send letting go - else only changes worth the traffic
+	if (level == lastSent) return false;
+	return level == 0 || lastSent == 0 || std::abs(level - lastSent) >= ENDSTOP_LEVEL_STEP;
+}
+
+void EndStops::sent(int level, Uint32 reaction)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	lastSent = level;
+	stats.updates++;
+	stats.lastReaction = reaction;
+	if (reaction > stats.maxReaction) stats.maxReaction = reaction;
+	if (reaction > ENDSTOP_REACTION_BUDGET) stats.overBudget++;
+	totalReaction += reaction;
+	stats.meanReaction = (Uint32)(totalReaction / stats.updates);
+}
+
+EndStopStats EndStops::getStats() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return stats;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <mutex>
+
+/*
+   Soft end-stops - virtual walls at a left and right angle.
+
+   Checked on every sample, so the wall pushes back within a sample
+   period of the wheel reaching it rather than whenever the caller
+   next polls. Past a limit the wall pushes back with stiffness level
+   per degree. It lets go once the wheel is hysteresis degrees back
+   inside, fading to nothing on the way so it doesn't chatter at the
+   edge.
+
+   The class only works out the force - the Wheel sends it.
+*/
+
+constexpr float ENDSTOP_STIFFNESS = 2000.0f; // level per degree
+constexpr float ENDSTOP_HYSTERESIS = 2.0f; // degrees
+constexpr Uint16 ENDSTOP_MAX_LEVEL = 32000;
+constexpr int ENDSTOP_LEVEL_STEP = 250; // smaller changes are not sent
+constexpr Uint32 ENDSTOP_REACTION_BUDGET = 2000; // uS from the sample to the force being sent
+constexpr float ENDSTOP_NONE = 10000.0f; // degrees - a limit that is never reached
+
+struct EndStopStats
+{
+	Uint32 hits = 0;			// times a wall was reached
+	Uint32 updates = 0;			// forces sent
+	Uint32 overBudget = 0;		// sent later than ENDSTOP_REACTION_BUDGET
+	Uint32 lastReaction = 0;	// uS from the sample to the force being sent
+	Uint32 maxReaction = 0;		// uS
+	Uint32 meanReaction = 0;	// uS
+	float deepest = 0.0f;		// degrees furthest past a limit, as measured
+};
+
+class EndStops
+{
+private:
+	float left, right;		// degrees
+	float stiffness;		// level per degree
+	float hysteresis;		// degrees
+	Uint16 maxLevel;
+	bool enabled;
+
+	int engaged;			// wall being pushed against - 0 none, -1 left, 1 right
+	int lastSent;			// level
+	Uint64 totalReaction;	// uS
+	EndStopStats stats;
+
+	mutable std::mutex lock; // configured by the caller, run by the sampler
+
+public:
+	EndStops();
+
+	void configure(float leftAngle, float rightAngle, float levelPerDegree, float hysteresisDegrees, Uint16 max);
+	void disable();
+	bool isEnabled() const;
+
+	// Level to send for angle - +ve turns right. false when it hasn't
+	// changed enough to be worth sending. The force works from angle,
+	// which may be predicted - the stats from where the wheel is measured
+	bool evaluate(float angle, float measured, int& level);
+
+	// The level from evaluate() was sent reaction uS after its sample
+	void sent(int level, Uint32 reaction);
+
+	EndStopStats getStats() const;
+};
@@ -0,0 +1,126 @@
+#include "Estimator.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <cmath>
+#include <cstring>
+
+Estimator::Estimator() : noise(ESTIMATOR_NOISE)
+{
+	reset();
+}
+
+void Estimator::reset()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	memset(x, 0, sizeof(x));
+	memset(P, 0, sizeof(P));
+	time = 0;
+	changed = 0;
+	last = 0;
+	started = false;
+}
+
+// Move state and covariance on by dt seconds
+void Estimator::predict(double dt, double state[3], double cov[3][3]) const
+{
+	double F[3][3] = { { 1.0, dt, dt * dt / 2.0 }, { 0.0, 1.0, dt }, { 0.0, 0.0, 1.0 } };
+
+	double s[3];
+	for (int i = 0; i < 3; ++i) s[i] = F[i][0] * state[0] + F[i][1] * state[1] + F[i][2] * state[2];
+	memcpy(state, s, sizeof(s));
+
+	// P = F P F' + Q for white jerk
+	double FP[3][3];
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			FP[i][j] = F[i][0] * cov[0][j] + F[i][1] * cov[1][j] + F[i][2] * cov[2][j];
+
+	double dt2 = dt * dt, dt3 = dt2 * dt, dt4 = dt3 * dt, dt5 = dt4 * dt;
+	double Q[3][3] = { { dt5 / 20.0, dt4 / 8.0, dt3 / 6.0 }, { dt4 / 8.0, dt3 / 3.0, dt2 / 2.0 }, { dt3 / 6.0, dt2 / 2.0, dt } };
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			cov[i][j] = FP[i][0] * F[j][0] + FP[i][1] * F[j][1] + FP[i][2] * F[j][2] + ESTIMATOR_JERK * Q[i][j];
+}
+
+void Estimator::update(Sint16 position, Uint64 now)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (!started)
+	{
+		x[0] = position;
+		x[1] = x[2] = 0.0;
+		memset(P, 0, sizeof(P));
+		P[0][0] = noise;
+		P[1][1] = 1.0e8;
+		P[2][2] = 1.0e12;
+		time = changed = now;
+		last = position;
+		started = true;
+		return;
+	}
+	if (now <= time) return;
+
+	predict((now - time) / 1.0e9, x, P);
+	time = now;
+
+	// Repeats are stale until they have held long enough to be real
+	if (position != last)
+	{
+		last = position;
+		changed = now;
+	}
+	else if (now - changed < ESTIMATOR_HOLD) return;
+
+	double S = P[0][0] + noise;
+	double K[3] = { P[0][0] / S, P[1][0] / S, P[2][0] / S };
+	double y = position - x[0];
+	for (int i = 0; i < 3; ++i) x[i] += K[i] * y;
+
+	double row[3] = { P[0][0], P[0][1], P[0][2] };
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			P[i][j] -= K[i] * row[j];
+}
+
+WheelEstimate Estimator::at(Uint64 now) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	WheelEstimate e;
+	if (!started) return e;
+
+	double state[3] = { x[0], x[1], x[2] };
+	double cov[3][3];
+	memcpy(cov, P, sizeof(cov));
+	if (now > time) predict((now - time) / 1.0e9, state, cov);
+
+	e.time = now > time ? now : time;
+	e.position = (float)state[0];
+	e.velocity = (float)state[1];
+	e.acceleration = (float)state[2];
+	e.positionSd = (float)std::sqrt(cov[0][0]);
+	e.velocitySd = (float)std::sqrt(cov[1][1]);
+	e.accelerationSd = (float)std::sqrt(cov[2][2]);
+	e.valid = true;
+	return e;
+}
+
+void Estimator::setNoise(double variance)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	noise = variance > ESTIMATOR_MIN_NOISE ? variance : ESTIMATOR_MIN_NOISE;
+}
+
+double Estimator::getNoise() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return noise;
+}
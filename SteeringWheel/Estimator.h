@@ -0,0 +1,68 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <mutex>
+
+/*
+   Streaming position, velocity and acceleration estimate.
+
+   A constant acceleration Kalman filter fed by the sampler. The wheel
+   only reports a new position every few mS so repeated readings are
+   treated as no news - the filter predicts through them and takes a
+   repeat as a measurement once it has held for ESTIMATOR_HOLD.
+   Reads never touch the device and can be made from any thread.
+*/
+
+constexpr double ESTIMATOR_JERK = 1.0e13; // counts^2/S^5 - how hard the wheel can change acceleration
+constexpr double ESTIMATOR_NOISE = 4.0; // counts^2 - position reading variance until measured
+constexpr double ESTIMATOR_MIN_NOISE = 0.25; // counts^2 - floor for measured variance
+constexpr Uint64 ESTIMATOR_HOLD = 8000000; // nS an unchanged reading is taken as real
+
+// Units are axis counts and seconds
+struct WheelEstimate
+{
+	Uint64 time = 0;			// nS, Wheel::now() clock
+	float position = 0.0f;
+	float velocity = 0.0f;
+	float acceleration = 0.0f;
+	float positionSd = 0.0f;	// one standard deviation
+	float velocitySd = 0.0f;
+	float accelerationSd = 0.0f;
+	bool valid = false;			// false until the first sample
+};
+
+class Estimator
+{
+private:
+	mutable std::mutex lock; // sampler writes, anyone reads
+	double x[3];		// position, velocity, acceleration
+	double P[3][3];		// covariance
+	double noise;		// measurement variance
+	Uint64 time;		// of x
+	Uint64 changed;		// when the reading last changed
+	Sint32 last;		// last reading
+	bool started;
+
+	void predict(double dt, double state[3], double cov[3][3]) const;
+
+public:
+	Estimator();
+
+	void reset();
+	void update(Sint16 position, Uint64 now);
+
+	// Estimate extrapolated to time (nS) - time before the last sample gives the last estimate
+	WheelEstimate at(Uint64 now) const;
+
+	// Position reading variance in counts^2
+	void setNoise(double variance);
+	double getNoise() const;
+};
@@ -0,0 +1,69 @@
+#include "Mailbox.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+constexpr Uint64 MAILBOX_TIME_MASK = (1ull << 48) - 1; // 48 bits of uS - about 8 years
+
+ForceMailbox::ForceMailbox() : slot(0), posts(0), taken(0), sent(0), coalesced(0), totalLatency(0), lastLatency(0), maxLatency(0)
+{
+}
+
+void ForceMailbox::post(Sint16 level, Uint64 now)
+{
+	slot.store((Uint64)(Uint16)level << 48 | ((now / 1000) & MAILBOX_TIME_MASK), std::memory_order_relaxed);
+	posts.fetch_add(1, std::memory_order_release);
+}
+
+bool ForceMailbox::pending() const
+{
+	return posts.load(std::memory_order_acquire) != taken;
+}
+
+bool ForceMailbox::take(Sint16& level, Uint64& posted)
+{
+	Uint64 count = posts.load(std::memory_order_acquire);
+	if (count == taken) return false;
+
+	Uint64 value = slot.load(std::memory_order_relaxed);
+	coalesced += count - taken - 1;
+	taken = count;
+
+	level = (Sint16)(Uint16)(value >> 48);
+	posted = (value & MAILBOX_TIME_MASK) * 1000;
+	return true;
+}
+
+void ForceMailbox::sentAt(Uint64 posted, Uint64 now)
+{
+	Uint32 latency = now > posted ? (Uint32)((now - posted) / 1000) : 0;
+	sent++;
+	lastLatency = latency;
+	if (latency > maxLatency) maxLatency = latency;
+	totalLatency += latency;
+}
+
+// Call while nothing is taking
+void ForceMailbox::reset()
+{
+	taken = posts;
+	sent = coalesced = totalLatency = 0;
+	lastLatency = maxLatency = 0;
+}
+
+MailboxStats ForceMailbox::getStats() const
+{
+	MailboxStats stats;
+	stats.posts = posts;
+	stats.sent = sent;
+	stats.coalesced = coalesced;
+	stats.lastLatency = lastLatency;
+	stats.maxLatency = maxLatency;
+	stats.meanLatency = stats.sent == 0 ? 0 : (Uint32)(totalLatency / stats.sent);
+	return stats;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <atomic>
+
+/*
+   Latest-value mailbox for a continuous force.
+
+   Producers overwrite the pending level - a single atomic store, so
+   posting never blocks however fast it is done. The sampler takes the
+   newest level when the device has a command slot free and sends that
+   one; anything posted before it was never worth sending and is
+   counted as coalesced. A 300 Hz force stream then lags by at most one
+   command interval instead of building a queue inside the driver.
+
+   Level and post time share one 64 bit word so they always match.
+*/
+
+struct MailboxStats
+{
+	Uint64 posts = 0;
+	Uint64 sent = 0;
+	Uint64 coalesced = 0;		// posted then overwritten before being sent
+	Uint32 lastLatency = 0;		// uS from post to sent
+	Uint32 maxLatency = 0;		// uS
+	Uint32 meanLatency = 0;		// uS
+};
+
+class ForceMailbox
+{
+private:
+	std::atomic<Uint64> slot;	// level << 48 | post time in uS
+	std::atomic<Uint64> posts;
+	Uint64 taken;				// posts when last taken - sampler only
+
+	std::atomic<Uint64> sent, coalesced, totalLatency;
+	std::atomic<Uint32> lastLatency, maxLatency;
+
+public:
+	ForceMailbox();
+
+	// Any thread - now in nS
+	void post(Sint16 level, Uint64 now);
+
+	// Sampler - is there anything newer than was last taken
+	bool pending() const;
+
+	// Sampler - the newest level, and when it was posted in nS
+	bool take(Sint16& level, Uint64& posted);
+
+	// Sampler - the level taken went to the device at now
+	void sentAt(Uint64 posted, Uint64 now);
+
+	void reset();
+	MailboxStats getStats() const;
+};
@@ -0,0 +1,51 @@
+#include "Motion.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <chrono>
+
+MotionHandle::MotionHandle()
+{
+}
+
+MotionHandle::MotionHandle(std::shared_ptr<MotionControl> control, std::shared_future<int> result) : control(control), result(result)
+{
+}
+
+bool MotionHandle::valid() const
+{
+	return control != nullptr && result.valid();
+}
+
+void MotionHandle::cancel()
+{
+	if (control != nullptr) control->cancel = true;
+}
+
+float MotionHandle::getProgress() const
+{
+	return control != nullptr ? control->progress.load() : 0.0f;
+}
+
+bool MotionHandle::isDone() const
+{
+	return waitFor(0);
+}
+
+bool MotionHandle::waitFor(Uint32 mS) const
+{
+	if (!result.valid()) return false;
+	return result.wait_for(std::chrono::milliseconds(mS)) == std::future_status::ready;
+}
+
+int MotionHandle::get() const
+{
+	if (!result.valid()) return MOTION_FAILED;
+	return result.get();
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+
+/*
+   Handles for operations run on the Wheel's command thread.
+
+   Each async call returns a MotionHandle straight away. The caller can
+   poll or wait on it, read progress, or cancel it. Cancelling (or
+   running past the timeout) makes the operation's loops and waits
+   return early - effects it started are still stopped on the way out.
+*/
+
+// Results
+constexpr int MOTION_OK = 0;
+constexpr int MOTION_FAILED = 1;
+constexpr int MOTION_CANCELLED = 2;
+constexpr int MOTION_TIMEOUT = 3;
+
+constexpr Uint32 MOTION_POLL = 10; // mS - longest a wait runs before checking for cancel
+constexpr float MOTION_PROGRESS_STEP = 0.01f; // smallest change passed to the callback
+
+// Called on the command thread - keep it short
+typedef std::function<void(float progress)> MotionProgress;
+
+// Shared by the handle and the command thread
+struct MotionControl
+{
+	std::atomic<bool> cancel{ false };
+	std::atomic<bool> timedOut{ false };
+	std::atomic<float> progress{ 0.0f };
+	float reported = -1.0f;	// last value passed to onProgress
+	Uint32 timeout = 0;		// mS from when it starts, 0 = none
+	Uint64 deadline = 0;	// nS, Wheel::now() clock
+	MotionProgress onProgress;
+};
+
+class MotionHandle
+{
+private:
+	std::shared_ptr<MotionControl> control;
+	std::shared_future<int> result;
+
+public:
+	MotionHandle();
+	MotionHandle(std::shared_ptr<MotionControl> control, std::shared_future<int> result);
+
+	bool valid() const;
+	void cancel();
+	float getProgress() const;
+	bool isDone() const;
+
+	// true if it finished within mS
+	bool waitFor(Uint32 mS) const;
+
+	// Blocks until finished - MOTION_OK, MOTION_FAILED, MOTION_CANCELLED or MOTION_TIMEOUT
+	int get() const;
+};
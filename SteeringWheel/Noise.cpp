@@ -0,0 +1,117 @@
+#include "Noise.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <cstring>
+
+NoiseMonitor::NoiseMonitor()
+{
+	reset();
+}
+
+void NoiseMonitor::reset()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	memset(regions, 0, sizeof(regions));
+	region = -1;
+	count = 0;
+}
+
+// Regions split the raw axis so they dont move when the locks are found
+int NoiseMonitor::regionOf(Sint16 position)
+{
+	return (int)(((Sint32)position - SDL_MIN_SINT16) * NOISE_REGIONS / 65536);
+}
+
+bool NoiseMonitor::sample(Sint16 position, bool idle)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	int r = regionOf(position);
+	if (!idle || r != region)
+	{
+		// Start again
+		region = idle ? r : -1;
+		count = 0;
+		if (!idle) return false;
+	}
+
+	if (count == 0)
+	{
+		sum = sumSquares = 0.0;
+		low = high = position;
+	}
+	count++;
+	sum += position;
+	if (count == NOISE_WINDOW / 2) firstHalf = sum;
+	sumSquares += (double)position * position;
+	if (position < low) low = position;
+	if (position > high) high = position;
+
+	if (high - low > NOISE_MAX_SPAN)
+	{
+		count = 0; // being moved
+		return false;
+	}
+	if (count < NOISE_WINDOW) return false;
+
+	double mean = sum / count;
+	double variance = sumSquares / count - mean * mean;
+	if (variance < 0.0) variance = 0.0;
+	count = 0;
+
+	int half = NOISE_WINDOW / 2;
+	double drift = (sum - firstHalf) / (NOISE_WINDOW - half) - firstHalf / half;
+	if (drift > NOISE_MAX_DRIFT || drift < -NOISE_MAX_DRIFT) return false;
+
+	Region& g = regions[region];
+	g.variance = g.windows == 0 ? variance : g.variance + NOISE_SMOOTHING * (variance - g.variance);
+	g.history[g.windows % NOISE_HISTORY] = high - low;
+	g.windows++;
+	return true;
+}
+
+NoiseEstimate NoiseMonitor::estimate(const Region& r) const
+{
+	NoiseEstimate e;
+	if (r.windows == 0) return e;
+
+	int n = r.windows < NOISE_HISTORY ? r.windows : NOISE_HISTORY;
+	for (int i = 0; i < n; ++i)
+	{
+		if (r.history[i] > e.peakToPeak) e.peakToPeak = r.history[i];
+	}
+	e.variance = r.variance;
+	e.windows = r.windows;
+	e.valid = true;
+	return e;
+}
+
+NoiseEstimate NoiseMonitor::at(Sint16 position) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return estimate(regions[regionOf(position)]);
+}
+
+NoiseEstimate NoiseMonitor::worst() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	NoiseEstimate w;
+	for (const Region& r : regions)
+	{
+		NoiseEstimate e = estimate(r);
+		if (!e.valid) continue;
+		if (!w.valid || e.variance > w.variance) w.variance = e.variance;
+		if (e.peakToPeak > w.peakToPeak) w.peakToPeak = e.peakToPeak;
+		w.windows += e.windows;
+		w.valid = true;
+	}
+	return w;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <mutex>
+
+/*
+   Position noise measured while the wheel is left alone.
+
+   The sampler passes every reading in with whether anything is
+   driving the wheel. Idle readings are gathered in windows of
+   NOISE_WINDOW samples; a window that spans more than NOISE_MAX_SPAN
+   counts, or whose halves have different means, is the wheel being
+   turned or still rolling and is thrown away. Each good
+   window updates a rolling variance and peak to peak for the region
+   of the axis it was taken in - noise is not the same all the way
+   round.
+*/
+
+constexpr auto NOISE_REGIONS = 18; // 50 degrees each on a G27
+constexpr auto NOISE_WINDOW = 100; // samples
+constexpr auto NOISE_MAX_SPAN = 40; // counts - larger windows are movement
+constexpr double NOISE_MAX_DRIFT = 3.0; // counts between the means of each half - more is a slow roll
+constexpr auto NOISE_HISTORY = 16; // windows the peak to peak is taken over
+constexpr double NOISE_SMOOTHING = 0.1; // weight of the newest window in the variance
+
+struct NoiseEstimate
+{
+	double variance = 0.0;	// counts^2
+	Sint16 peakToPeak = 0;	// counts, largest of the last NOISE_HISTORY windows
+	Uint32 windows = 0;		// windows measured
+	bool valid = false;
+};
+
+class NoiseMonitor
+{
+private:
+	struct Region
+	{
+		double variance;
+		Sint16 history[NOISE_HISTORY];
+		Uint32 windows;
+	};
+
+	mutable std::mutex lock; // sampler writes, anyone reads
+	Region regions[NOISE_REGIONS];
+
+	// Window being gathered
+	int region;
+	int count;
+	double sum;
+	double firstHalf; // sum of the first NOISE_WINDOW / 2
+	double sumSquares;
+	Sint16 low, high;
+
+	static int regionOf(Sint16 position);
+	NoiseEstimate estimate(const Region& r) const;
+
+public:
+	NoiseMonitor();
+
+	void reset();
+
+	// Returns true when a window completed - the estimate has changed
+	bool sample(Sint16 position, bool idle);
+
+	// Noise where the wheel is, or the worst measured anywhere
+	NoiseEstimate at(Sint16 position) const;
+	NoiseEstimate worst() const;
+};
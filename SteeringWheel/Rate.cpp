@@ -0,0 +1,116 @@
+#include "Rate.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <algorithm>
+
+RatePoint rateTrial(Uint32 rate, Uint64 elapsed, std::vector<Uint64>& latencies, Uint32 failures)
+{
+	RatePoint point;
+	point.rate = rate;
+	point.failures = failures;
+	if (latencies.empty() || elapsed == 0) return point;
+
+	size_t n = latencies.size();
+	point.achieved = (float)(n * 1.0e9 / elapsed);
+
+	// Queueing shows as each call taking longer than the one before
+	size_t quarter = std::max<size_t>(n / 4, 1);
+	double first = 0.0, last = 0.0, total = 0.0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		total += latencies[i];
+		if (i < quarter) first += latencies[i];
+		if (i >= n - quarter) last += latencies[i];
+	}
+	point.meanLatency = (float)(total / n / 1000.0);
+	point.growth = first > 0.0 ? (float)(last / first) : 1.0f;
+
+	std::sort(latencies.begin(), latencies.end());
+	point.p95Latency = latencies[std::min(n - 1, n * 95 / 100)] / 1000.0f;
+	point.maxLatency = latencies[n - 1] / 1000.0f;
+
+	bool queueing = point.growth > RATE_GROWTH && last / quarter / 1000.0 > RATE_LAG_FLOOR;
+	point.sustained = failures == 0 && !queueing && point.achieved >= rate * RATE_ACHIEVED && point.p95Latency * rate < 1.0e6f;
+	return point;
+}
+
+CommandRate::CommandRate() : interval(0), nextSlot(0), commands(0), paced(0), waited(0), skipped(0)
+{
+	setRate(COMMAND_RATE);
+}
+
+void CommandRate::setRate(Uint32 hz)
+{
+	interval = hz == RATE_UNLIMITED ? 0 : 1000000000ull / hz;
+}
+
+Uint32 CommandRate::getRate() const
+{
+	Uint64 gap = interval;
+	return gap == 0 ? RATE_UNLIMITED : (Uint32)(1000000000ull / gap);
+}
+
+Uint64 CommandRate::reserve(Uint64 now)
+{
+	commands++;
+	Uint64 gap = interval;
+	if (gap == 0) return now;
+
+	// Slot is the later of now and the one after the last command
+	Uint64 slot = nextSlot.load();
+	Uint64 mine;
+	do
+	{
+		mine = std::max(slot, now);
+	} while (!nextSlot.compare_exchange_weak(slot, mine + gap));
+
+	if (mine > now)
+	{
+		paced++;
+		waited += (mine - now) / 1000;
+	}
+	return mine;
+}
+
+bool CommandRate::tryReserve(Uint64 now)
+{
+	Uint64 gap = interval;
+	if (gap != 0)
+	{
+		// Another thread may take the slot between the check and the claim
+		Uint64 slot = nextSlot.load();
+		do
+		{
+			if (slot > now) return false;
+		} while (!nextSlot.compare_exchange_weak(slot, now + gap));
+	}
+	commands++;
+	return true;
+}
+
+bool CommandRate::ready(Uint64 now) const
+{
+	return interval == 0 || nextSlot <= now;
+}
+
+void CommandRate::skip()
+{
+	skipped++;
+}
+
+CommandRateStats CommandRate::getStats() const
+{
+	CommandRateStats stats;
+	stats.commands = commands;
+	stats.paced = paced;
+	stats.waited = waited;
+	stats.skipped = skipped;
+	return stats;
+}
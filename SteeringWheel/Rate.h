@@ -0,0 +1,93 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <atomic>
+#include <vector>
+
+/*
+   How fast the device can take commands, and keeping to it.
+
+   Commands sent faster than the device takes them are queued by the
+   driver - each one lands later than the last. CommandRate spaces the
+   commands sent to the device (new, update, run, stop, destroy, gain,
+   pause) at least one interval apart. A command that would be early
+   waits for its slot; the sampler claims a slot with tryReserve() and
+   skips a sample when none is due.
+
+   characteriseRates() times each command for each effect type at a
+   rising rate and finds the fastest the device keeps up with - the
+   rate it manages and the latency not growing over the trial.
+*/
+
+constexpr Uint32 COMMAND_RATE = 500; // Hz - G27 USB interval is 2 mS, until measured
+constexpr Uint32 RATE_UNLIMITED = 0;
+constexpr Uint32 RATE_TRIAL = 100; // mS at each rate
+constexpr float RATE_ACHIEVED = 0.95f; // of the rate asked for
+constexpr float RATE_GROWTH = 1.5f; // last quarter latency / first quarter - more is queueing
+constexpr float RATE_LAG_FLOOR = 100.0f; // uS - growth below this is noise, not queueing
+constexpr float RATE_MARGIN = 0.8f; // of the fastest sustained rate enforced
+constexpr Uint32 RATE_STEPS[] = { 100, 250, 500, 1000, 2000 }; // Hz tried
+
+struct CommandRateStats
+{
+	Uint64 commands = 0;
+	Uint64 paced = 0;		// waited for a slot
+	Uint64 waited = 0;		// uS in total
+	Uint64 skipped = 0;		// end-stop updates left for the next sample
+};
+
+// One rate tried for one command
+struct RatePoint
+{
+	Uint32 rate = 0;			// Hz asked for
+	float achieved = 0.0f;		// Hz managed
+	float meanLatency = 0.0f;	// uS per call
+	float p95Latency = 0.0f;	// uS
+	float maxLatency = 0.0f;	// uS
+	float growth = 0.0f;		// last quarter latency / first quarter
+	Uint32 failures = 0;		// calls the device refused
+	bool sustained = false;
+};
+
+struct RateResult
+{
+	const char* command = "";	// "new", "update" or "run"
+	const char* effect = "";	// "constant", "periodic", "condition" or "ramp"
+	std::vector<RatePoint> points;
+	Uint32 sustained = 0;		// Hz - fastest sustained, 0 if none
+};
+
+// Summary of one trial - latencies in nS in the order they were sent
+RatePoint rateTrial(Uint32 rate, Uint64 elapsed, std::vector<Uint64>& latencies, Uint32 failures);
+
+class CommandRate
+{
+private:
+	std::atomic<Uint64> interval;	// nS, 0 = unlimited
+	std::atomic<Uint64> nextSlot;	// nS
+	std::atomic<Uint64> commands, paced, waited, skipped;
+
+public:
+	CommandRate();
+
+	void setRate(Uint32 hz);
+	Uint32 getRate() const;
+
+	// Take the next slot - returns when it may be sent
+	Uint64 reserve(Uint64 now);
+	// Would a command sent now be on time
+	bool ready(Uint64 now) const;
+	// Take the slot only if it is due - never waits
+	bool tryReserve(Uint64 now);
+	void skip();
+
+	CommandRateStats getStats() const;
+};
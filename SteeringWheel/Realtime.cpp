@@ -0,0 +1,131 @@
+#include "Realtime.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <cerrno>
+#endif
+
+static_assert((CYCLE_HISTORY & (CYCLE_HISTORY - 1)) == 0, "CYCLE_HISTORY must be a power of 2");
+
+// Keep every page resident - now and as the process grows
+int realtimeLockMemory(bool lock)
+{
+#ifdef __linux__
+	int result = lock ? mlockall(MCL_CURRENT | MCL_FUTURE) : munlockall();
+	return result == 0 ? 0 : errno;
+#elif defined(_WIN32)
+	(void)lock;
+	return ERROR_NOT_SUPPORTED; // working set locking is per region on Windows
+#else
+	return -1;
+#endif
+}
+
+// Raise the calling thread and pin it - cpu REALTIME_ANY_CPU to leave it free
+int realtimeThread(int priority, int cpu)
+{
+#ifdef __linux__
+	if (cpu != REALTIME_ANY_CPU)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (result != 0) return result;
+	}
+
+	sched_param param;
+	param.sched_priority = 0;
+	if (priority <= 0) return pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+	param.sched_priority = std::min(std::max(priority, sched_get_priority_min(SCHED_FIFO)), sched_get_priority_max(SCHED_FIFO));
+	return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#elif defined(_WIN32)
+	if (cpu != REALTIME_ANY_CPU && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) == 0) return (int)GetLastError();
+	int level = priority <= 0 ? THREAD_PRIORITY_NORMAL : THREAD_PRIORITY_TIME_CRITICAL;
+	return SetThreadPriority(GetCurrentThread(), level) ? 0 : (int)GetLastError();
+#else
+	(void)priority;
+	(void)cpu;
+	return -1;
+#endif
+}
+
+// Fault in the stack the loop will use, so it isn't done mid cycle
+void realtimePrefaultStack()
+{
+	volatile unsigned char stack[REALTIME_STACK];
+	for (size_t i = 0; i < REALTIME_STACK; i += 4096) stack[i] = 0;
+	(void)stack[0];
+}
+
+CycleMonitor::CycleMonitor() : sum(0.0), sumSquares(0.0), count(0), deadline(REALTIME_DEADLINE)
+{
+}
+
+void CycleMonitor::setDeadline(Uint32 deadlineUs)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	deadline = deadlineUs;
+}
+
+void CycleMonitor::reset()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	stats = CycleStats();
+	sum = sumSquares = 0.0;
+	count = 0;
+}
+
+void CycleMonitor::record(Uint64 due, Uint64 woke, Uint64 done, Uint64 skipped)
+{
+	Uint32 late = woke > due ? (Uint32)std::min<Uint64>((woke - due) / NS_PER_US, SDL_MAX_UINT32) : 0;
+	Uint32 busy = done > woke ? (Uint32)std::min<Uint64>((done - woke) / NS_PER_US, SDL_MAX_UINT32) : 0;
+
+	std::lock_guard<std::mutex> guard(lock);
+	lateness[count & (CYCLE_HISTORY - 1)] = late;
+	count++;
+
+	stats.cycles++;
+	stats.skipped += skipped;
+	if (late > deadline) stats.misses++;
+	if (late > stats.maxLateness) stats.maxLateness = late;
+	if (busy > stats.maxBusy) stats.maxBusy = busy;
+
+	sum += late;
+	sumSquares += (double)late * late;
+	double mean = sum / stats.cycles;
+	stats.meanLateness = (float)mean;
+	stats.jitter = (float)std::sqrt(std::max(0.0, sumSquares / stats.cycles - mean * mean));
+}
+
+CycleStats CycleMonitor::getStats() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return stats;
+}
+
+size_t CycleMonitor::history(Uint32* values, size_t max) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	max = (size_t)std::min<Uint64>(max, std::min<Uint64>(count, CYCLE_HISTORY));
+	Uint64 first = count - max;
+	for (size_t i = 0; i < max; ++i) values[i] = lateness[(first + i) & (CYCLE_HISTORY - 1)];
+	return max;
+}
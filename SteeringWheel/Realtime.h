@@ -0,0 +1,91 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <mutex>
+#include "Clock.h"
+
+/*
+   Real-time running for the fixed rate loops, and their timing.
+
+   Off by default. When on, the sampler and the command thread raise
+   themselves to SCHED_FIFO (time critical on Windows), can be pinned
+   to a CPU, and touch their stack up front. The process memory is
+   locked so none of it is paged out under them. Linux needs
+   CAP_SYS_NICE or an rtprio limit for SCHED_FIFO, and a memlock
+   limit for mlockall - failures are reported and the loops carry on
+   as before.
+
+   Every cycle's lateness is measured whether real-time is on or not.
+*/
+
+constexpr int REALTIME_PRIORITY = 80; // SCHED_FIFO 1 - 99, the command thread runs one below
+constexpr int REALTIME_ANY_CPU = -1;
+constexpr size_t REALTIME_STACK = 256 * 1024; // bytes of stack touched up front
+constexpr Uint32 REALTIME_DEADLINE = 100; // uS late before a cycle counts as missed
+constexpr Uint32 REALTIME_SPIN = 100; // uS - a FIFO thread wakes on time, spinning longer only starves the CPU
+constexpr size_t CYCLE_HISTORY = 1024; // cycles kept
+
+// Loops that are timed
+constexpr int LOOP_SAMPLER = 0;
+constexpr int LOOP_CONTROL = 1; // moveTo()
+
+struct RealtimeOptions
+{
+	bool enabled = false;
+	int priority = REALTIME_PRIORITY;
+	int samplerCpu = REALTIME_ANY_CPU;
+	int controlCpu = REALTIME_ANY_CPU;
+	bool lockMemory = true;
+	Uint32 spinUs = REALTIME_SPIN; // sampler sleeps spin this long at the end - at most half a period
+	Uint32 deadlineUs = REALTIME_DEADLINE;
+};
+
+struct CycleStats
+{
+	Uint64 cycles = 0;
+	Uint64 misses = 0;			// later than the deadline
+	Uint64 skipped = 0;			// whole periods lost to an overrun
+	float meanLateness = 0.0f;	// uS after the cycle was due
+	float jitter = 0.0f;		// uS - standard deviation of lateness
+	Uint32 maxLateness = 0;		// uS
+	Uint32 maxBusy = 0;			// uS from waking to done
+};
+
+// 0 or the OS error
+int realtimeLockMemory(bool lock);
+int realtimeThread(int priority, int cpu); // priority 0 back to normal
+void realtimePrefaultStack();
+
+class CycleMonitor
+{
+private:
+	CycleStats stats;
+	double sum, sumSquares;		// uS, for the mean and jitter
+	Uint32 lateness[CYCLE_HISTORY]; // uS
+	Uint64 count;
+	Uint32 deadline;			// uS
+
+	mutable std::mutex lock; // loop writes, caller reads
+
+public:
+	CycleMonitor();
+
+	void setDeadline(Uint32 deadlineUs);
+	void reset();
+
+	// due, woke and done in nS - skipped periods given by the loop
+	void record(Uint64 due, Uint64 woke, Uint64 done, Uint64 skipped = 0);
+
+	CycleStats getStats() const;
+
+	// Lateness in uS, oldest first - returns how many were copied
+	size_t history(Uint32* values, size_t max) const;
+};
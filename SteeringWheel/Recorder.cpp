@@ -0,0 +1,267 @@
+#include "Recorder.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <sstream>
+#include <algorithm>
+#include <cstdint> // SIZE_MAX
+
+Recorder::Recorder() : start(0), reads(0), readTime(0), lastPosition(SDL_MAX_SINT32)
+{
+}
+
+// Start a session file with the wheel's current setup
+bool Recorder::open(const std::string& name, Uint64 now, unsigned int capabilities, Sint16 leftLock, Sint16 rightLock, Sint16 centre, Sint16 jitter, int gain, unsigned int seed)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	file.open(name, std::ios::out | std::ios::trunc);
+	if (!file.is_open()) return false;
+
+	start = now;
+	reads = 0;
+	readTime = 0;
+	lastPosition = SDL_MAX_SINT32;
+	lastStatus.clear();
+	file << "H " << capabilities << " " << leftLock << " " << rightLock << " " << centre << " " << jitter << " " << gain << " " << seed << "\n";
+	return true;
+}
+
+bool Recorder::isOpen()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return file.is_open();
+}
+
+void Recorder::close()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (!file.is_open()) return;
+
+	file << "R " << (reads > 0 ? readTime / reads : DEFAULT_READ_COST) << "\n";
+	file.close();
+}
+
+void Recorder::sample(Uint64 now, Sint16 position)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (!file.is_open() || position == lastPosition || now < start) return;
+	lastPosition = position;
+	file << "S " << (now - start) / 1000 << " " << position << "\n";
+}
+
+// Effect status is an input like position - only changes are written
+void Recorder::status(Uint64 now, unsigned int effect, int status)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (!file.is_open()) return;
+
+	auto last = lastStatus.find(effect);
+	if (last != lastStatus.end() && last->second == status) return;
+	lastStatus[effect] = status;
+	file << "Q " << (now - start) / 1000 << " " << effect << " " << status << "\n";
+}
+
+// Cost of a position or status read - used to advance virtual time in replay
+void Recorder::read(Uint64 duration)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	reads++;
+	readTime += duration;
+}
+
+void Recorder::command(Uint64 now, Uint64 duration, int result, const std::string& command)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (!file.is_open()) return;
+	file << "C " << (now - start) / 1000 << " " << duration << " " << result << " " << command << "\n";
+}
+
+Session::Session() : sampleCursor(0), commandCursor(0), divergenceCount(0), matched(0), maxDrift(0), reported(SIZE_MAX), finished(false),
+	capabilities(0), leftLock(SDL_MAX_SINT16), rightLock(SDL_MIN_SINT16), centre(0), jitter(0), gain(100), seed(0), readCost(DEFAULT_READ_COST)
+{
+}
+
+bool Session::load(const std::string& name)
+{
+	std::ifstream file(name);
+	if (!file.is_open()) return false;
+
+	samples.clear();
+	statuses.clear();
+	commands.clear();
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.size() < 2) continue;
+
+		std::istringstream in(line.substr(2));
+		switch (line[0])
+		{
+		case 'H':
+			in >> capabilities >> leftLock >> rightLock >> centre >> jitter >> gain >> seed;
+			break;
+		case 'S':
+		{
+			Uint64 t;
+			Sint16 p;
+			if (in >> t >> p) samples.push_back({ t * 1000, p });
+			break;
+		}
+		case 'Q':
+		{
+			Uint64 t;
+			unsigned int e;
+			int q;
+			if (in >> t >> e >> q) statuses[e].push_back({ t * 1000, commands.size(), q });
+			break;
+		}
+		case 'C':
+		{
+			RecordedCommand c;
+			if (in >> c.time >> c.duration >> c.result)
+			{
+				c.time *= 1000;
+				in >> std::ws;
+				std::getline(in, c.command);
+				commands.push_back(c);
+			}
+			break;
+		}
+		case 'R':
+			in >> readCost;
+			break;
+		}
+	}
+
+	// Sampler and caller both record so times can be slightly out of order
+	std::stable_sort(samples.begin(), samples.end(), [](const RecordedSample& a, const RecordedSample& b) { return a.time < b.time; });
+
+	rewind();
+	return true;
+}
+
+void Session::rewind()
+{
+	sampleCursor = 0;
+	commandCursor = 0;
+	divergenceCount = 0;
+	matched = 0;
+	maxDrift = 0;
+	reported = SIZE_MAX;
+	finished = false;
+	divergences.clear();
+}
+
+// Position recorded at virtual time now - virtual time only moves forward
+Sint16 Session::positionAt(Uint64 now)
+{
+	if (samples.empty()) return 0;
+
+	if (sampleCursor > 0 && samples[sampleCursor].time > now) sampleCursor = 0;
+	while (sampleCursor + 1 < samples.size() && samples[sampleCursor + 1].time <= now) ++sampleCursor;
+	return samples[sampleCursor].position;
+}
+
+// Effect status recorded at virtual time now. Only statuses seen after
+// the last matched command count - the new code's timing may differ.
+int Session::statusAt(unsigned int effect, Uint64 now, int fallback)
+{
+	auto found = statuses.find(effect);
+	if (found == statuses.end()) return fallback;
+
+	const std::vector<RecordedStatus>& list = found->second;
+	auto first = std::lower_bound(list.begin(), list.end(), commandCursor, [](const RecordedStatus& s, size_t c) { return s.command < c; });
+	if (first == list.end() || first->command != commandCursor) return fallback;
+
+	auto best = first;
+	for (auto it = first; it != list.end() && it->command == commandCursor && it->time <= now; ++it) best = it;
+	return best->status;
+}
+
+void Session::diverge(size_t index, Uint64 now, const std::string& expected, const std::string& got)
+{
+	divergenceCount++;
+	if (divergences.size() < MAX_DIVERGENCES) divergences.push_back({ index, now, expected, got });
+}
+
+int Session::command(Uint64 now, const std::string& command, int fallback, Uint64& duration)
+{
+	duration = 0;
+	if (finished) return fallback;
+
+	// In step
+	if (commandCursor < commands.size() && commands[commandCursor].command == command)
+	{
+		const RecordedCommand& c = commands[commandCursor++];
+		Uint64 drift = now > c.time ? now - c.time : c.time - now;
+		if (drift > maxDrift) maxDrift = drift;
+		matched++;
+		duration = c.duration;
+		return c.result;
+	}
+
+	// Look ahead - recorded commands skipped by the new code are missing
+	for (size_t i = commandCursor + 1; i < commands.size() && i <= commandCursor + RESYNC_WINDOW; ++i)
+	{
+		if (commands[i].command == command)
+		{
+			for (size_t j = commandCursor; j < i; ++j)
+			{
+				if (j != reported) diverge(j, now, commands[j].command, "");
+			}
+			commandCursor = i;
+			return this->command(now, command, fallback, duration);
+		}
+	}
+
+	// Nothing like it - an extra command
+	if (commandCursor < commands.size())
+	{
+		diverge(commandCursor, now, commands[commandCursor].command, command);
+		reported = commandCursor;
+	}
+	else diverge(commandCursor, now, "", command);
+	return fallback;
+}
+
+void Session::finish(Uint64 now)
+{
+	if (finished) return;
+
+	for (; commandCursor < commands.size(); ++commandCursor)
+	{
+		if (commandCursor != reported) diverge(commandCursor, now, commands[commandCursor].command, "");
+	}
+	finished = true;
+}
+
+bool Session::diverged() const
+{
+	return divergenceCount > 0;
+}
+
+const std::vector<Divergence>& Session::getDivergences() const
+{
+	return divergences;
+}
+
+std::string Session::summary() const
+{
+	std::string s = "Replay: " + std::to_string(matched) + " of " + std::to_string(commands.size()) + " commands matched, ";
+	s += std::to_string(divergenceCount) + " divergences, max drift " + std::to_string(maxDrift / 1000) + " uS";
+	for (const Divergence& d : divergences)
+	{
+		s += "\n  #" + std::to_string(d.index) + " at " + std::to_string(d.time / 1000) + " uS";
+		if (d.got.empty()) s += " missing: " + d.expected;
+		else if (d.expected.empty()) s += " extra: " + d.got;
+		else s += " expected: " + d.expected + " got: " + d.got;
+	}
+	return s;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <map>
+
+/*
+   Session recording and replay.
+
+   A recording holds what the device reported - positions looked up by
+   time on replay, effect status looked up by time between the same two
+   commands - and every command sent to
+   the device with its result and how long it took. Replaying it
+   through a Wheel built from a Session runs the Wheel API in virtual
+   time with no device attached - waits cost nothing - and flags where
+   the new command stream differs from the recorded one.
+
+   File format (text, one record per line, times in uS):
+	H <capabilities> <leftLock> <rightLock> <centre> <jitter> <gain> <seed>
+	S <time> <position>
+	Q <time> <effect> <status>
+	C <time> <duration nS> <result> <command>
+	R <read cost nS>
+*/
+
+constexpr Uint64 DEFAULT_READ_COST = 50000; // nS per position read in replay
+constexpr auto RESYNC_WINDOW = 32; // commands searched ahead after a divergence
+constexpr auto MAX_DIVERGENCES = 100; // details kept
+
+struct RecordedSample
+{
+	Uint64 time; // nS from start
+	Sint16 position;
+};
+
+struct RecordedStatus
+{
+	Uint64 time; // nS from start
+	size_t command; // commands recorded before it
+	int status;
+};
+
+struct RecordedCommand
+{
+	Uint64 time; // nS from start
+	Uint64 duration; // nS
+	int result;
+	std::string command;
+};
+
+struct Divergence
+{
+	size_t index;			// recorded command number
+	Uint64 time;			// nS virtual time
+	std::string expected;	// empty if the new code sent an extra command
+	std::string got;		// empty if the new code missed a command
+};
+
+// Writes a session as it happens
+class Recorder
+{
+private:
+	std::ofstream file;
+	std::mutex lock; // sampler and caller both write
+	Uint64 start;
+	Uint64 reads;
+	Uint64 readTime;
+	Sint32 lastPosition; // only changes are written
+	std::map<unsigned int, int> lastStatus;
+
+public:
+	Recorder();
+
+	bool open(const std::string& name, Uint64 now, unsigned int capabilities, Sint16 leftLock, Sint16 rightLock, Sint16 centre, Sint16 jitter, int gain, unsigned int seed);
+	bool isOpen();
+	void close();
+
+	void sample(Uint64 now, Sint16 position);
+	void status(Uint64 now, unsigned int effect, int status);
+	void read(Uint64 duration);
+	void command(Uint64 now, Uint64 duration, int result, const std::string& command);
+};
+
+// A recorded session fed back through the Wheel API
+class Session
+{
+private:
+	std::vector<RecordedSample> samples;
+	std::map<unsigned int, std::vector<RecordedStatus>> statuses;
+	std::vector<RecordedCommand> commands;
+	std::vector<Divergence> divergences;
+	size_t sampleCursor;
+	size_t commandCursor;
+	Uint64 divergenceCount;
+	Uint64 matched;
+	Uint64 maxDrift;
+	size_t reported; // recorded command already reported as mismatched
+	bool finished;
+
+	void diverge(size_t index, Uint64 now, const std::string& expected, const std::string& got);
+
+public:
+	Session();
+
+	// Header values
+	unsigned int capabilities;
+	Sint16 leftLock, rightLock, centre, jitter;
+	int gain;
+	unsigned int seed;
+	Uint64 readCost;
+
+	bool load(const std::string& name);
+	void rewind();
+
+	Sint16 positionAt(Uint64 now);
+	// Status seen between the same two commands in the recording
+	int statusAt(unsigned int effect, Uint64 now, int fallback);
+
+	// Compare a command with the recording. Returns the recorded result
+	// or fallback if there is nothing to match.
+	int command(Uint64 now, const std::string& command, int fallback, Uint64& duration);
+
+	// End of the compared stream - recorded commands never sent by the
+	// new code are reported and later commands are ignored
+	void finish(Uint64 now);
+
+	bool diverged() const;
+	const std::vector<Divergence>& getDivergences() const;
+	std::string summary() const;
+};
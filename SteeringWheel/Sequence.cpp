@@ -0,0 +1,408 @@
+#include "Sequence.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include "Wheel.h"
+#include "Effect.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include "Clock.h"
+
+// Names used in sequence files
+static const std::map<std::string, unsigned int> effectNames = {
+	{ "LEFT", LEFT }, { "RIGHT", RIGHT }, { "SINE", SINE }, { "TRIANGLE", TRIANGLE },
+	{ "SAWUP", SAWUP }, { "SAWDOWN", SAWDOWN }, { "SPRING", SPRING }, { "DAMPER", DAMPER },
+	{ "INERTIA", INERTIA }, { "FRICTION", FRICTION }, { "RAMP_LEFT", RAMP_LEFT }, { "RAMP_RIGHT", RAMP_RIGHT }
+};
+
+static const std::map<std::string, int> directionNames = {
+	{ "LEFT", LEFT }, { "RIGHT", RIGHT }, { "UP", UP }, { "DOWN", DOWN }
+};
+
+static bool readEffect(std::istream& in, unsigned int& effect)
+{
+	std::string name;
+	if (!(in >> name)) return false;
+	auto found = effectNames.find(name);
+	if (found == effectNames.end()) return false;
+	effect = found->second;
+	return true;
+}
+
+static bool readDirection(std::istream& in, int& dir)
+{
+	std::string name;
+	if (!(in >> name)) return false;
+	auto found = directionNames.find(name);
+	if (found == directionNames.end()) return false;
+	dir = found->second;
+	return true;
+}
+
+// Values are read as int - anything the effect can't hold is a bad line, not wrapped
+static bool inRange(int value, int low, int high)
+{
+	return value >= low && value <= high;
+}
+
+// Length in mS or FOREVER
+static bool readLength(std::istream& in, Uint32& mS)
+{
+	std::string word;
+	if (!(in >> word)) return false;
+	if (word == "FOREVER")
+	{
+		mS = FOREVER;
+		return true;
+	}
+	std::istringstream value(word);
+	return (bool)(value >> mS);
+}
+
+Sequence::Sequence() : running(false), stopping(false), postFailures(std::make_shared<std::atomic<Uint64>>(0))
+{
+}
+
+Sequence::~Sequence()
+{
+	stop();
+}
+
+void Sequence::add(Uint64 time, const std::string& name, SequenceAction action)
+{
+	events.push_back({ time, name, action });
+}
+
+// Effect and gain changes run on the Wheel's command thread, the only
+// thread that touches the device. The event counts as dispatched once
+// posted - a command that then fails is counted when it runs.
+SequenceAction Sequence::posted(SequenceAction action)
+{
+	return [this, action](Wheel& wheel)
+	{
+		std::shared_ptr<std::atomic<Uint64>> failures = postFailures;
+		Wheel* target = &wheel;
+		return wheel.post([action, target]() { return action(*target) ? 0 : EFFECT_ERROR; },
+			[failures](int result) { if (result != 0) (*failures)++; });
+	};
+}
+
+void Sequence::runEffect(Uint64 time, unsigned int effect, Uint32 iterations)
+{
+	add(time, "run " + std::to_string(effect), posted([effect, iterations](Wheel& wheel) { return wheel.runEffect(effect, iterations); }));
+}
+
+void Sequence::stopEffect(Uint64 time, unsigned int effect)
+{
+	add(time, "stop " + std::to_string(effect), posted([effect](Wheel& wheel) { return wheel.stopEffect(effect); }));
+}
+
+bool Sequence::setEffect(Uint64 time, const EffectDescriptor& effect)
+{
+	if (!effect.valid()) return false;
+	add(time, "set " + std::to_string(effect.slot), posted([effect](Wheel& wheel) { return wheel.setEffect(effect); }));
+	return true;
+}
+
+// Motion targets run on the Wheel's command thread
+void Sequence::gotoAngle(Uint64 time, float angle, Uint16 level)
+{
+	Sint32 angleMd = (Sint32)std::lround(angle * MDEG_PER_DEGREE);
+	add(time, "goto " + std::to_string(angle), [this, angleMd, level](Wheel& wheel)
+	{
+		motions.push_back(wheel.gotoAngleMdAsync(angleMd, level));
+		return true;
+	});
+}
+
+void Sequence::moveTo(Uint64 time, float angle, float maxVelocity)
+{
+	add(time, "move " + std::to_string(angle), [this, angle, maxVelocity](Wheel& wheel)
+	{
+		motions.push_back(wheel.moveToAsync(angle, maxVelocity));
+		return true;
+	});
+}
+
+void Sequence::followPath(Uint64 time, const std::vector<Waypoint>& waypoints, float maxVelocity)
+{
+	add(time, "path " + std::to_string(waypoints.size()), [this, waypoints, maxVelocity](Wheel& wheel)
+	{
+		motions.push_back(wheel.followPathAsync(waypoints, maxVelocity));
+		return true;
+	});
+}
+
+void Sequence::clear()
+{
+	events.clear();
+}
+
+// One line of a sequence file. last is the time of the previous event.
+bool Sequence::parse(const std::string& line, Uint64& last)
+{
+	std::istringstream in(line.substr(0, line.find('#')));
+	std::string when, command;
+	if (!(in >> when)) return true; // blank or comment
+	if (!(in >> command)) return false;
+
+	// Time in mS - absolute or +relative
+	bool relative = when[0] == '+';
+	double mS;
+	std::istringstream t(relative ? when.substr(1) : when);
+	if (!(t >> mS) || mS < 0) return false;
+	Uint64 time = (Uint64)(mS * 1000.0 + 0.5) + (relative ? last : 0);
+	last = time;
+
+	std::string name = command;
+	std::string args;
+	std::getline(in, args);
+	if (!args.empty()) name += args;
+	std::istringstream a(args);
+
+	unsigned int effect;
+	int dir;
+	Uint32 len, period, dly;
+	int lvl, rSat, lSat, rCo, lCo, start, end;
+
+	if (command == "run")
+	{
+		Uint32 iterations = 1;
+		if (!readEffect(a, effect)) return false;
+		a >> iterations;
+		runEffect(time, effect, iterations);
+		events.back().name = name;
+	}
+	else if (command == "stop")
+	{
+		if (!readEffect(a, effect)) return false;
+		stopEffect(time, effect);
+		events.back().name = name;
+	}
+	else if (command == "gain")
+	{
+		int gain;
+		if (!(a >> gain)) return false;
+		add(time, name, posted([gain](Wheel& wheel) { return wheel.setGain(gain) != EFFECT_ERROR; }));
+	}
+	else if (command == "left" || command == "right")
+	{
+		if (!readLength(a, len) || !(a >> lvl) || !inRange(lvl, MIN_LEVEL, MAX)) return false;
+		if (!setEffect(time, constantEffect(command == "left" ? LEFT : RIGHT, len, lvl))) return false;
+		events.back().name = name;
+	}
+	else if (command == "sine" || command == "triangle" || command == "sawup" || command == "sawdown")
+	{
+		if (!readLength(a, len) || !(a >> period >> lvl) || !readDirection(a, dir) || !inRange(lvl, MIN_LEVEL, MAX)) return false;
+		effect = command == "sine" ? SINE : command == "triangle" ? TRIANGLE : command == "sawup" ? SAWUP : SAWDOWN;
+		if (!setEffect(time, periodicEffect(effect, len, period, lvl, dir))) return false;
+		events.back().name = name;
+	}
+	else if (command == "spring" || command == "damper" || command == "inertia" || command == "friction")
+	{
+		int dead = 0, centre = 0;
+		if (!readLength(a, len) || !(a >> dly >> rSat >> lSat >> rCo >> lCo)) return false;
+		a >> dead >> centre;
+		if (!inRange(rSat, MIN_SAT_LEVEL, SDL_MAX_UINT16) || !inRange(lSat, MIN_SAT_LEVEL, SDL_MAX_UINT16)) return false;
+		if (!inRange(rCo, MIN_COEF_LEVEL, SDL_MAX_SINT16) || !inRange(lCo, MIN_COEF_LEVEL, SDL_MAX_SINT16)) return false;
+		if (!inRange(dead, MIN_DEADBAND, SDL_MAX_UINT16) || !inRange(centre, MIN_CENTRE, SDL_MAX_SINT16)) return false;
+		effect = command == "spring" ? SPRING : command == "damper" ? DAMPER : command == "inertia" ? INERTIA : FRICTION;
+		if (!setEffect(time, conditionEffect(effect, len, dly, rSat, lSat, rCo, lCo, dead, centre))) return false;
+		events.back().name = name;
+	}
+	else if (command == "rampleft" || command == "rampright")
+	{
+		if (!readLength(a, len) || !(a >> start >> end)) return false;
+		if (!inRange(start, MIN_START_LEVEL, MAX_START_LEVEL) || !inRange(end, MIN_END_LEVEL, MAX_END_LEVEL)) return false;
+		if (!setEffect(time, rampEffect(command == "rampleft" ? RAMP_LEFT : RAMP_RIGHT, len, start, end))) return false;
+		events.back().name = name;
+	}
+	else if (command == "goto")
+	{
+		float angle;
+		int level = NORMAL;
+		if (!(a >> angle)) return false;
+		a >> level;
+		gotoAngle(time, angle, level);
+		events.back().name = name;
+	}
+	else if (command == "move")
+	{
+		float angle, velocity = 0.0f;
+		if (!(a >> angle)) return false;
+		a >> velocity;
+		moveTo(time, angle, velocity);
+		events.back().name = name;
+	}
+	else if (command == "path")
+	{
+		std::vector<Waypoint> waypoints;
+		std::string point;
+		while (a >> point)
+		{
+			Waypoint waypoint;
+			size_t at = point.find('@');
+			std::istringstream p(point.substr(0, at));
+			if (!(p >> waypoint.position)) return false;
+			if (at != std::string::npos)
+			{
+				float segment;
+				std::istringstream m(point.substr(at + 1));
+				if (!(m >> segment) || segment <= 0.0f) return false;
+				waypoint.time = segment / 1000.0f;
+			}
+			waypoints.push_back(waypoint);
+		}
+		if (waypoints.empty()) return false;
+		followPath(time, waypoints);
+		events.back().name = name;
+	}
+	else return false;
+
+	return true;
+}
+
+bool Sequence::load(const std::string& name)
+{
+	std::ifstream file(name);
+	if (!file.is_open())
+	{
+		error = "Cant open sequence (" + name + ")";
+		return false;
+	}
+
+	clear();
+	std::string line;
+	int number = 0;
+	Uint64 last = 0;
+	while (std::getline(file, line))
+	{
+		++number;
+		if (!parse(line, last))
+		{
+			error = name + " line " + std::to_string(number) + ": " + line;
+			clear();
+			return false;
+		}
+	}
+
+	error.clear();
+	return true;
+}
+
+std::string Sequence::getError() const
+{
+	return error;
+}
+
+size_t Sequence::size() const
+{
+	return events.size();
+}
+
+bool Sequence::start(Wheel& wheel)
+{
+	if (running) return false;
+	if (runner.joinable()) runner.join();
+
+	// Events at the same time keep the order they were added in
+	std::stable_sort(events.begin(), events.end(), [](const SequenceEvent& a, const SequenceEvent& b) { return a.time < b.time; });
+
+	stats = SequenceStats();
+	postFailures = std::make_shared<std::atomic<Uint64>>(0);
+	lateness.clear();
+	lateness.reserve(events.size());
+	motions.clear();
+	stopping = false;
+	running = true;
+	runner = std::thread(&Sequence::play, this, std::ref(wheel));
+	return true;
+}
+
+// Sleep to just short of each event then spin onto it
+void Sequence::play(Wheel& wheel)
+{
+	Uint64 origin = clockNow() + SEQUENCE_LEAD * NS_PER_US;
+
+	for (const SequenceEvent& event : events)
+	{
+		Uint64 due = origin + event.time * NS_PER_US;
+		Uint64 wake = due - SEQUENCE_SPIN * NS_PER_US;
+
+		while (!stopping && clockNow() < wake)
+		{
+			sleepUntil(std::min(wake, clockNow() + SEQUENCE_POLL * NS_PER_MS), 0);
+		}
+		if (stopping) break;
+
+		sleepUntil(due, SEQUENCE_SPIN);
+		Uint64 late = clockNow() - due;
+		bool ok = event.action(wheel);
+
+		lateness.push_back(late);
+		stats.events++;
+		if (!ok) stats.failed++;
+		if (late > SEQUENCE_LATE * 1000ull) stats.late++;
+		stats.totalLate += late;
+		if (late > stats.maxLate) stats.maxLate = late;
+	}
+
+	running = false;
+}
+
+bool Sequence::isRunning() const
+{
+	return running;
+}
+
+void Sequence::wait()
+{
+	if (runner.joinable()) runner.join();
+}
+
+void Sequence::stop()
+{
+	stopping = true;
+	if (runner.joinable()) runner.join();
+	for (MotionHandle& motion : motions) motion.cancel();
+}
+
+// Only valid once the sequence has finished
+SequenceStats Sequence::getStats() const
+{
+	SequenceStats total = stats;
+	if (postFailures) total.failed += *postFailures;
+	return total;
+}
+
+void Sequence::report(Wheel& wheel)
+{
+	if (running)
+	{
+		wheel.log("Sequence: still running");
+		return;
+	}
+	if (stats.events == 0)
+	{
+		wheel.log("Sequence: no events dispatched");
+		return;
+	}
+
+	SequenceStats stats = getStats();
+	for (size_t i = 0; i < lateness.size(); ++i)
+	{
+		std::string uS = std::to_string(1000 + events[i].time % 1000).substr(1);
+		wheel.log("Sequence " + std::to_string(events[i].time / 1000) + "." + uS + " mS " + events[i].name + " late " + std::to_string(lateness[i] / 1000) + " uS");
+	}
+	wheel.log("Sequence events: " + std::to_string(stats.events) + " failed: " + std::to_string(stats.failed) + " over " + std::to_string(SEQUENCE_LATE) + " uS late: " + std::to_string(stats.late));
+	wheel.log("Sequence lateness uS mean: " + std::to_string(stats.totalLate / stats.events / 1000) + " max: " + std::to_string(stats.maxLate / 1000));
+}
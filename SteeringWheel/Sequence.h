@@ -0,0 +1,120 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Motion.h"
+#include "Trajectory.h"
+
+class Wheel;
+struct EffectDescriptor;
+
+/*
+   Timed effect sequences.
+
+   A timeline of effect starts, stops, parameter changes and motion
+   targets, built in code or loaded from a file. It is played on its
+   own thread against clockNow() - each event sleeps until just
+   before its time then spins the rest of the way. Effect, gain and
+   motion events are handed to the Wheel's command thread - effects as
+   posted commands, motions as async calls so they don't hold up later
+   events. Actions given to add() run on the sequence thread. Effect
+   parameters are checked and packed when the file is loaded, so
+   playing one is a single upload or update.
+
+   File format - one event per line, # starts a comment:
+	<time mS> <command> <args...>
+   time is from the start of the sequence, or +mS after the previous
+   event. Decimal times are allowed (1500.25). Commands:
+	run <effect> [iterations]	stop <effect>		gain <0-100>
+	left <mS> <lvl>				right <mS> <lvl>
+	sine|triangle|sawup|sawdown <mS> <period> <lvl> <UP|DOWN|LEFT|RIGHT>
+	spring|damper|inertia|friction <mS> <dly> <rSat> <lSat> <rCo> <lCo> [dead] [centre]
+	rampleft|rampright <mS> <start> <end>
+	goto <angle> [level]		move <angle> [deg/S]
+	path <angle>[@mS] ...		- through each angle without stopping, @mS from the one before
+   Effects are named as in Wheel.h (RAMP_LEFT etc). FOREVER may be used for mS.
+   Angles are degrees and may have decimals (12.5).
+*/
+
+constexpr Uint32 SEQUENCE_SPIN = 2000; // uS before an event spent spinning rather than sleeping
+constexpr Uint32 SEQUENCE_LEAD = 5000; // uS from start() to time 0
+constexpr Uint32 SEQUENCE_LATE = 1000; // uS - events later than this are counted
+constexpr Uint32 SEQUENCE_POLL = 10; // mS - longest sleep before checking for stop
+
+typedef std::function<bool(Wheel& wheel)> SequenceAction;
+
+struct SequenceEvent
+{
+	Uint64 time;			// uS from the start
+	std::string name;		// for the report
+	SequenceAction action;
+};
+
+struct SequenceStats
+{
+	Uint64 events = 0;		// dispatched
+	Uint64 failed = 0;		// action returned false
+	Uint64 late = 0;		// later than SEQUENCE_LATE
+	Uint64 totalLate = 0;	// nS - divide by events for mean
+	Uint64 maxLate = 0;		// nS
+};
+
+class Sequence
+{
+private:
+	std::vector<SequenceEvent> events;
+	std::vector<Uint64> lateness; // nS per dispatched event
+	std::vector<MotionHandle> motions;
+	SequenceStats stats;
+	std::string error;
+
+	std::thread runner;
+	std::atomic<bool> running;
+	std::atomic<bool> stopping;
+	std::shared_ptr<std::atomic<Uint64>> postFailures; // counted on the command thread, may outlive us
+
+	bool parse(const std::string& line, Uint64& last);
+	SequenceAction posted(SequenceAction action);
+	void play(Wheel& wheel);
+
+public:
+	Sequence();
+	~Sequence();
+
+	// Build in code - time in uS from the start
+	void add(Uint64 time, const std::string& name, SequenceAction action);
+	void runEffect(Uint64 time, unsigned int effect, Uint32 iterations = 1);
+	void stopEffect(Uint64 time, unsigned int effect);
+	bool setEffect(Uint64 time, const EffectDescriptor& effect); // false if not valid
+	void gotoAngle(Uint64 time, float angle, Uint16 level); // to the millidegree
+	void moveTo(Uint64 time, float angle, float maxVelocity = 0.0f);
+	void followPath(Uint64 time, const std::vector<Waypoint>& waypoints, float maxVelocity = 0.0f);
+	void clear();
+
+	// Replaces the timeline - false with getError() set on a bad line
+	bool load(const std::string& name);
+	std::string getError() const;
+	size_t size() const;
+
+	// Plays on its own thread - false if already playing
+	bool start(Wheel& wheel);
+	bool isRunning() const;
+	void wait(); // until the last event has been dispatched
+	void stop(); // also cancels motion targets
+
+	SequenceStats getStats() const;
+	void report(Wheel& wheel);
+};
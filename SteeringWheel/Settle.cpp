@@ -0,0 +1,77 @@
+#include "Settle.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <chrono>
+
+SettleDetector::SettleDetector() : low(0), high(0), start(0), tracking(false), settled(false), band(SETTLE_AUTO_BAND), hold(SETTLE_HOLD)
+{
+}
+
+void SettleDetector::configure(Uint16 newBand, Uint32 holdMs)
+{
+	band = newBand;
+	hold = holdMs;
+}
+
+Uint16 SettleDetector::getBand() const
+{
+	return band;
+}
+
+void SettleDetector::sample(Sint16 position, Uint64 now, Uint16 autoBand)
+{
+	Uint16 limit = band == SETTLE_AUTO_BAND ? autoBand : (Uint16)band;
+
+	if (!tracking)
+	{
+		low = high = position;
+		start = now;
+		tracking = true;
+	}
+	if (position < low) low = position;
+	if (position > high) high = position;
+
+	// Moved out of band - start the hold again from here
+	if (high - low > limit)
+	{
+		low = high = position;
+		start = now;
+		settled = false;
+		return;
+	}
+
+	if (settled || now - start < hold * 1000000ull) return;
+
+	SettleCallback notify;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		settled = true; // under the lock so a waiter cant miss it
+		notify = callback;
+	}
+	changed.notify_all();
+	if (notify) notify(now, position);
+}
+
+bool SettleDetector::isSettled() const
+{
+	return settled;
+}
+
+bool SettleDetector::waitFor(Uint32 mS)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	return changed.wait_for(guard, std::chrono::milliseconds(mS), [this]() { return settled.load(); });
+}
+
+void SettleDetector::onSettled(SettleCallback settledCallback)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	callback = settledCallback;
+}
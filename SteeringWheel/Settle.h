@@ -0,0 +1,61 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+/*
+   Stationarity from the sample stream.
+
+   The wheel is settled once every reading for the hold time has
+   stayed within the band. Any reading outside it starts the hold
+   again. Runs in the sampler so isSettled() answers at once and
+   waiters and the callback are woken on the sample that settles it.
+*/
+
+constexpr Uint32 SETTLE_HOLD = 50; // mS
+constexpr Uint16 SETTLE_AUTO_BAND = 0; // band from measured noise + JITTER_MARGIN
+
+// Called on the sampler thread - keep it short
+typedef std::function<void(Uint64 time, Sint16 position)> SettleCallback;
+
+class SettleDetector
+{
+private:
+	Sint16 low, high;		// readings since start
+	Uint64 start;			// nS - time of the first reading in band
+	bool tracking;
+	std::atomic<bool> settled;
+	std::atomic<Uint16> band;	// counts, SETTLE_AUTO_BAND to use the noise
+	std::atomic<Uint32> hold;	// mS
+
+	std::mutex lock;
+	std::condition_variable changed;
+	SettleCallback callback;
+
+public:
+	SettleDetector();
+
+	void configure(Uint16 band, Uint32 holdMs);
+	Uint16 getBand() const;
+
+	// autoBand is used when the band is SETTLE_AUTO_BAND
+	void sample(Sint16 position, Uint64 now, Uint16 autoBand);
+
+	bool isSettled() const;
+
+	// Wakes early when settled - true if settled
+	bool waitFor(Uint32 mS);
+
+	void onSettled(SettleCallback settledCallback);
+};
@@ -0,0 +1,147 @@
+#include "SharedMemory.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+SharedMemory::SharedMemory() : address(nullptr), bytes(0), owner(false), mapping(nullptr)
+{
+}
+#else
+SharedMemory::SharedMemory() : address(nullptr), bytes(0), owner(false), fd(-1)
+{
+}
+#endif
+
+SharedMemory::~SharedMemory()
+{
+	close();
+}
+
+bool SharedMemory::create(const std::string& name, size_t size)
+{
+	close();
+	this->name = name;
+	bytes = size;
+	owner = true;
+	if (!map(true)) return false;
+	memset(address, 0, bytes);
+	return true;
+}
+
+bool SharedMemory::open(const std::string& name, size_t size)
+{
+	close();
+	this->name = name;
+	bytes = size;
+	owner = false;
+	return map(false);
+}
+
+#ifdef _WIN32
+
+bool SharedMemory::map(bool create)
+{
+	if (create)
+	{
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)bytes >> 32), (DWORD)(bytes & 0xFFFFFFFF), name.c_str());
+	}
+	else
+	{
+		mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+	}
+
+	if (mapping == NULL)
+	{
+		mapping = nullptr;
+		return false;
+	}
+
+	address = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+	if (address == NULL)
+	{
+		address = nullptr;
+		CloseHandle(mapping);
+		mapping = nullptr;
+		return false;
+	}
+	return true;
+}
+
+void SharedMemory::close()
+{
+	if (address != nullptr) UnmapViewOfFile(address);
+	if (mapping != nullptr) CloseHandle(mapping);
+	address = nullptr;
+	mapping = nullptr;
+}
+
+#else
+
+bool SharedMemory::map(bool create)
+{
+	std::string shmName = "/" + name;
+	fd = shm_open(shmName.c_str(), create ? (O_CREAT | O_RDWR) : O_RDWR, 0666);
+	if (fd < 0) return false;
+
+	if (create && ftruncate(fd, (off_t)bytes) != 0)
+	{
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+
+	void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+	{
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+	address = p;
+	return true;
+}
+
+void SharedMemory::close()
+{
+	if (address != nullptr) munmap(address, bytes);
+	if (owner && fd >= 0) shm_unlink(("/" + name).c_str());
+	if (fd >= 0) ::close(fd);
+	address = nullptr;
+	fd = -1;
+}
+
+#endif
+
+bool SharedMemory::isOpen() const
+{
+	return address != nullptr;
+}
+
+void* SharedMemory::data() const
+{
+	return address;
+}
+
+size_t SharedMemory::size() const
+{
+	return bytes;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <string>
+#include <cstddef>
+
+/*
+   Named block of memory shared between processes on the same machine.
+   Windows uses a page file backed mapping, everything else POSIX shm.
+   The creator owns the name and removes it when closed.
+*/
+class SharedMemory
+{
+private:
+	std::string name;
+	void* address;
+	size_t bytes;
+	bool owner;
+
+#ifdef _WIN32
+	void* mapping;
+#else
+	int fd;
+#endif
+
+	bool map(bool create);
+
+public:
+	SharedMemory();
+	~SharedMemory();
+
+	SharedMemory(const SharedMemory&) = delete;
+	SharedMemory& operator=(const SharedMemory&) = delete;
+
+	// Create (or reuse) a block - memory is zeroed
+	bool create(const std::string& name, size_t size);
+
+	// Attach to a block made by another process
+	bool open(const std::string& name, size_t size);
+
+	void close();
+
+	bool isOpen() const;
+	void* data() const;
+	size_t size() const;
+};
@@ -7,8 +7,14 @@ Version 0.1
 */
 
 #include "Wheel.h"
-#include <ctime>
+#include "Telemetry.h"
+#include "Sequence.h"
+#include "Clock.h"
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <string>
 
 // levels
 constexpr auto LEVEL8 = 8000;
@@ -23,13 +29,80 @@ constexpr auto NAME = "G27";
 constexpr auto TIMEOUT = 120000;
 
 
+// Stand-in for a simulator - writes a swaying rack force and a
+// rough patch of road at 400 Hz while the wheel follows it
+void telemetryDemo(Wheel* wheel, Uint32 mS)
+{
+    TelemetryProducer producer;
+    if (!producer.create())
+    {
+        std::cout << "Could not create telemetry ring" << std::endl;
+        return;
+    }
+
+    std::atomic<bool> stop(false);
+    std::thread sim([&producer, &stop]()
+    {
+        int frame = 0;
+        while (!stop)
+        {
+            float t = frame / 400.0f;
+            float rough = (frame / 800) % 2 ? 0.3f : 0.0f;
+            producer.publish(0.8f * std::sin(t), 0.0f, rough, 40.0f);
+            sleepFor(2500 * NS_PER_US, 200); // a frame a little late doesn't matter - dont spin most of the period
+            ++frame;
+        }
+    });
+
+    TelemetryInput input;
+    if (input.open(*wheel))
+    {
+        Uint64 start = clockNow();
+        while (clockNow() - start < mS * NS_PER_MS) input.poll(*wheel);
+        input.report(*wheel);
+    }
+
+    stop = true;
+    sim.join();
+    wheel->stopEffect(TELEMETRY_FORCE);
+    wheel->stopEffect(TELEMETRY_TEXTURE);
+}
+
+// The scripted part of a run - recorded with --record <file> and
+// re-run against the recording with --replay <file>
+void script(Wheel* wheel)
+{
+    wheel->calibrate();
+}
+
 int main(int argc, char** argv)
 {
+    std::string mode = argc > 2 ? argv[1] : "";
+
+    // Replay a recorded session - no wheel needed
+    if (mode == "--replay")
+    {
+        Session session;
+        if (!session.load(argv[2]))
+        {
+            std::cout << "Cant load session " << argv[2] << std::endl;
+            return 1;
+        }
+
+        Wheel* wheel = new Wheel(session);
+        script(wheel);
+        wheel->stopRecording();
+        delete wheel;
+
+        std::cout << session.summary() << std::endl;
+        return session.diverged() ? 1 : 0;
+    }
+
     std::cout << "Plug in haptic wheel within 2 minutes..." << std::endl;
 
     // Wait for haptic wheel to be plugged in
     bool found = false;
-    clock_t start = clock();
+    Uint64 start = clockNow();
     while (!found)
     {
         // Create a wheel object
@@ -37,8 +110,7 @@ int main(int argc, char** argv)
         if (test->validDevice() && test->validHaptic()) found = true;
         //test->wait(1000);
         delete test;
-        clock_t now = clock();
-        if (now - start >= TIMEOUT && !found) break;
+        if (clockNow() - start >= TIMEOUT * NS_PER_MS && !found) break;
     }
 
     // We have a device
@@ -47,12 +119,15 @@ int main(int argc, char** argv)
         Wheel* wheel = new Wheel(NAME, true);
         if (wheel->validDevice() && wheel->validHaptic())
         {
+            //wheel->publishState(); // for dashboards / loggers
             //wheel->getGain();
             //wheel->setGain(50);
             //wheel->getGain();
             //wheel->getMaxGain();
             //wheel->wait(3000);
-            wheel->calibrate();
+            if (mode == "--record") wheel->startRecording(argv[2]);
+            script(wheel);
+            wheel->stopRecording();
 
             //wheel->wait(2000);
 
@@ -96,6 +171,13 @@ int main(int argc, char** argv)
             //wheel->runEffect(LEFT, 1);
             //wheel->wait(250);
             //wheel->getDistance(10);
+            //telemetryDemo(wheel, 10000);
+            //Sequence sequence; // timed effects - see Sequence.h for the file format
+            //if (sequence.load("demo.seq") && sequence.start(*wheel)) { sequence.wait(); sequence.report(*wheel); }
+            //MotionHandle move = wheel->gotoAngleAsync(90, NORMAL, 3000); // returns at once
+            //while (!move.waitFor(10)) { /* read pedals */ }
+            //wheel->followPath({ { 38 }, { -90 }, { 90 }, { -120, 0.8f }, { 0 } }); // no stop between them - 0.8 S to -120
+            //PathStats path = wheel->getPathStats();
             //wheel->setGain(100);
             //wheel->wait(5000);
 
@@ -138,38 +220,15 @@ int main(int argc, char** argv)
             wheel->runEffect(SPRING);
             wheel->setRight(FOREVER, 32000);
             wheel->setSine(FOREVER, 50, 20000, DOWN);
-            wheel->setRampRight(1000, 32000, 10000);
-            int last = 0;
-            int now = 0;
-            bool backstop = false;
+            // Virtual backstop at -30 degrees - pushed back by the sampler
+            wheel->setEndStops(-30, ENDSTOP_NONE);
             bool done = false;
             while (!done)
             {
-                now = wheel->getPosition();
-
-                if (last != now)
-                {
-                    std::cout << "Position: " << now << std::endl;
-                    //std::cout << "Angle   : " << wheel->getAngle() << std::endl;
-
-                    if (now < wheel->calculatePosition(-30) && !backstop)
-                    {
-                        wheel->runEffect(RAMP_RIGHT);
-                        //->runEffect(SINE);
-                        backstop = true;
-                    }
-                    if (now > wheel->calculatePosition(-30) && backstop)
-                    {
-                        backstop = false;
-                        wheel->stopEffect(RAMP_RIGHT);
-                        //wheel->stopEffect(SINE);
-
-                    }
-
-                }
-                last = now;
-
-
+                wheel->wait(1000);
+                EndStopStats stops = wheel->getEndStopStats();
+                std::cout << "Backstop hits: " << stops.hits << " deepest: " << stops.deepest
+                    << " reaction mean: " << stops.meanReaction << " uS max: " << stops.maxReaction << " uS" << std::endl;
             }
 
 
@@ -0,0 +1,164 @@
+#include "Telemetry.h"
+#include "Wheel.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <new>
+#include "Clock.h"
+
+TelemetryProducer::TelemetryProducer() : ring(nullptr)
+{
+}
+
+// Create the ring ready for a TelemetryInput to open
+bool TelemetryProducer::create(const std::string& name)
+{
+	if (!memory.create(name, sizeof(TelemetryRing))) return false;
+
+	ring = new (memory.data()) TelemetryRing();
+	ring->capacity = TELEMETRY_RING_SIZE;
+	ring->version = TELEMETRY_VERSION;
+	ring->head.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	ring->magic = TELEMETRY_MAGIC;
+	return true;
+}
+
+// Write the next frame - never blocks, oldest frames are overwritten
+bool TelemetryProducer::publish(float rackForce, float slip, float roadTexture, float textureFrequency)
+{
+	if (ring == nullptr) return false;
+
+	Uint64 n = ring->head.load(std::memory_order_relaxed) + 1;
+	TelemetryFrame& frame = ring->frames[(n - 1) & (TELEMETRY_RING_SIZE - 1)];
+
+	// Mark slot as being written
+	frame.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	frame.rackForce.store(rackForce, std::memory_order_relaxed);
+	frame.slip.store(slip, std::memory_order_relaxed);
+	frame.roadTexture.store(roadTexture, std::memory_order_relaxed);
+	frame.textureFrequency.store(textureFrequency, std::memory_order_relaxed);
+	frame.timestamp.store(clockNow(), std::memory_order_relaxed);
+
+	frame.sequence.store(n, std::memory_order_release);
+	ring->head.store(n, std::memory_order_release);
+	return true;
+}
+
+TelemetryInput::TelemetryInput() : ring(nullptr), lastFrame(0), levelPerNm(0.0f)
+{
+}
+
+// Attach to a ring created by the simulator
+bool TelemetryInput::open(Wheel& wheel, const std::string& name)
+{
+	if (!memory.open(name, sizeof(TelemetryRing)))
+	{
+		wheel.log("Error: Telemetry (" + name + ") not available");
+		return false;
+	}
+
+	ring = static_cast<TelemetryRing*>(memory.data());
+	if (ring->magic != TELEMETRY_MAGIC || ring->version != TELEMETRY_VERSION || ring->capacity != TELEMETRY_RING_SIZE)
+	{
+		wheel.log("Error: Telemetry (" + name + ") has wrong format");
+		memory.close();
+		ring = nullptr;
+		return false;
+	}
+
+	// Start from the newest frame
+	lastFrame = ring->head.load(std::memory_order_acquire);
+	rescale(wheel);
+	resetStats();
+
+	wheel.log("Telemetry (" + name + ") opened");
+	return true;
+}
+
+// Work out Nm to level once - call again if gain is changed
+void TelemetryInput::rescale(Wheel& wheel)
+{
+	double maxForce = wheel.convertLevelToForce(MAX);
+	levelPerNm = (maxForce > 0.0) ? (float)(MAX / maxForce) : 0.0f;
+}
+
+// Apply the newest frame to the wheel. Returns false if nothing new.
+// Frames are read in place - no copies, no allocation.
+bool TelemetryInput::poll(Wheel& wheel)
+{
+	if (ring == nullptr) return false;
+
+	Uint64 head = ring->head.load(std::memory_order_acquire);
+	if (head == lastFrame) return false;
+
+	const TelemetryFrame& frame = ring->frames[(head - 1) & (TELEMETRY_RING_SIZE - 1)];
+
+	float force = frame.rackForce.load(std::memory_order_relaxed) * (1.0f - frame.slip.load(std::memory_order_relaxed));
+	float texture = frame.roadTexture.load(std::memory_order_relaxed);
+	float frequency = frame.textureFrequency.load(std::memory_order_relaxed);
+	Uint64 timestamp = frame.timestamp.load(std::memory_order_relaxed);
+
+	// Producer lapped us mid read - pick it up next poll
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (frame.sequence.load(std::memory_order_relaxed) != head)
+	{
+		stats.torn++;
+		return false;
+	}
+
+	stats.skipped += head - lastFrame - 1;
+	lastFrame = head;
+
+	// Nm to level
+	float level = force * levelPerNm;
+	if (level > MAX) level = MAX;
+	if (level < -MAX) level = -MAX;
+
+	if (texture < 0.0f) texture = 0.0f;
+	if (texture > 1.0f) texture = 1.0f;
+	Uint32 period = frequency > 0.0f ? (Uint32)(1000.0f / frequency) : 0;
+
+	wheel.applyTelemetry((Sint16)level, (Uint16)(texture * MAX), period);
+
+	// Latency from simulator write to wheel command completed
+	Uint64 latency = (clockNow() - timestamp) / 1000;
+	if (stats.frames == 0 || latency < stats.minLatency) stats.minLatency = latency;
+	if (latency > stats.maxLatency) stats.maxLatency = latency;
+	if (latency > TELEMETRY_LATENCY_BUDGET) stats.overBudget++;
+	stats.totalLatency += latency;
+	stats.frames++;
+
+	return true;
+}
+
+const TelemetryStats& TelemetryInput::getStats() const
+{
+	return stats;
+}
+
+void TelemetryInput::resetStats()
+{
+	stats = TelemetryStats();
+}
+
+void TelemetryInput::report(Wheel& wheel)
+{
+	if (stats.frames == 0)
+	{
+		wheel.log("Telemetry: no frames applied");
+		return;
+	}
+
+	wheel.log("Telemetry frames: " + std::to_string(stats.frames) + " skipped: " + std::to_string(stats.skipped) + " torn: " + std::to_string(stats.torn));
+	wheel.log("Telemetry latency uS min: " + std::to_string(stats.minLatency) + " mean: " + std::to_string(stats.totalLatency / stats.frames) + " max: " + std::to_string(stats.maxLatency));
+	wheel.log("Telemetry frames over " + std::to_string(TELEMETRY_LATENCY_BUDGET) + " uS budget: " + std::to_string(stats.overBudget));
+}
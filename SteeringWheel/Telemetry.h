@@ -0,0 +1,101 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <atomic>
+#include <string>
+#include "SharedMemory.h"
+
+class Wheel;
+
+/*
+   Vehicle state written by a simulator into a shared memory ring.
+   The simulator (or a stand-in) uses TelemetryProducer, the process
+   owning the Wheel uses TelemetryInput from its control loop.
+*/
+
+constexpr auto TELEMETRY_NAME = "G27Telemetry";
+constexpr Uint32 TELEMETRY_MAGIC = 0x47323754; // "G27T"
+constexpr Uint32 TELEMETRY_VERSION = 1;
+constexpr Uint32 TELEMETRY_RING_SIZE = 64; // power of 2
+constexpr auto TELEMETRY_LATENCY_BUDGET = 3000; // uS sim to wheel
+
+// One frame of vehicle state - every field is atomic so a read the
+// producer laps is detected by the sequence rather than undefined
+struct TelemetryFrame
+{
+	std::atomic<Uint64> sequence;			// frame number - written last
+	std::atomic<Uint64> timestamp;			// producer time stamp (nS, clockNow())
+	std::atomic<float> rackForce;			// Nm at the wheel, +ve turns right
+	std::atomic<float> slip;				// 0 = full grip, 1 = sliding
+	std::atomic<float> roadTexture;			// 0 - 1 amplitude of surface vibration
+	std::atomic<float> textureFrequency;	// Hz of surface vibration
+};
+
+// Layout of the shared block
+struct TelemetryRing
+{
+	Uint32 magic;
+	Uint32 version;
+	Uint32 capacity;
+	std::atomic<Uint64> head;		// number of frames written
+	TelemetryFrame frames[TELEMETRY_RING_SIZE];
+};
+
+static_assert(std::atomic<Uint64>::is_always_lock_free, "Telemetry ring needs lock free 64 bit atomics");
+static_assert(std::atomic<float>::is_always_lock_free, "Telemetry ring needs lock free float atomics");
+
+// Sim to wheel latency figures
+struct TelemetryStats
+{
+	Uint64 frames = 0;			// frames applied to the wheel
+	Uint64 skipped = 0;			// frames superseded before they were read
+	Uint64 torn = 0;			// frames overwritten while being read
+	Uint64 overBudget = 0;		// frames over TELEMETRY_LATENCY_BUDGET
+	Uint64 minLatency = 0;		// uS
+	Uint64 maxLatency = 0;		// uS
+	Uint64 totalLatency = 0;	// uS - divide by frames for mean
+};
+
+// Writer side - the simulator or a local stand-in
+class TelemetryProducer
+{
+private:
+	SharedMemory memory;
+	TelemetryRing* ring;
+
+public:
+	TelemetryProducer();
+
+	bool create(const std::string& name = TELEMETRY_NAME);
+	bool publish(float rackForce, float slip, float roadTexture, float textureFrequency);
+};
+
+// Reader side - call poll() from the control loop
+class TelemetryInput
+{
+private:
+	SharedMemory memory;
+	TelemetryRing* ring;
+	Uint64 lastFrame;
+	float levelPerNm;
+	TelemetryStats stats;
+
+public:
+	TelemetryInput();
+
+	bool open(Wheel& wheel, const std::string& name = TELEMETRY_NAME);
+	void rescale(Wheel& wheel);
+	bool poll(Wheel& wheel);
+
+	const TelemetryStats& getStats() const;
+	void resetStats();
+	void report(Wheel& wheel);
+};
@@ -0,0 +1,226 @@
+#include "Trajectory.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <cmath>
+
+Trajectory::Trajectory() : start(0.0f), distance(0.0f), direction(1.0f), jerk(0.0f), peakVelocity(0.0f),
+	peakAcceleration(0.0f), jerkTime(0.0f), accelTime(0.0f), cruiseTime(0.0f)
+{
+}
+
+// Timing of an acceleration phase from rest to peak velocity
+void Trajectory::accelPhase(float peak, float& tj, float& ta, float& am) const
+{
+	if (jerk <= 0.0f)
+	{
+		tj = 0.0f;
+		ta = peak / peakAcceleration;
+		am = peakAcceleration;
+	}
+	else if (peak * jerk >= peakAcceleration * peakAcceleration)
+	{
+		// Reaches the acceleration limit
+		tj = peakAcceleration / jerk;
+		ta = peak / peakAcceleration + tj;
+		am = peakAcceleration;
+	}
+	else
+	{
+		// Jerk up then straight back down
+		tj = std::sqrt(peak / jerk);
+		ta = 2.0f * tj;
+		am = jerk * tj;
+	}
+}
+
+bool Trajectory::plan(float from, float to, const MotionLimits& limits)
+{
+	start = from;
+	distance = std::fabs(to - from);
+	direction = to < from ? -1.0f : 1.0f;
+	jerk = limits.jerk;
+	peakAcceleration = limits.acceleration;
+	peakVelocity = limits.velocity;
+	jerkTime = accelTime = cruiseTime = 0.0f;
+
+	if (limits.velocity <= 0.0f || limits.acceleration <= 0.0f || limits.jerk < 0.0f) return false;
+	if (distance == 0.0f)
+	{
+		peakVelocity = 0.0f;
+		return true;
+	}
+
+	// Acceleration and deceleration each cover peak * ta / 2
+	float tj, ta, am;
+	accelPhase(peakVelocity, tj, ta, am);
+	if (peakVelocity * ta > distance)
+	{
+		// Too short to cruise - find the peak that just fits
+		float low = 0.0f;
+		float high = peakVelocity;
+		for (int i = 0; i < PLAN_SEARCH_STEPS; ++i)
+		{
+			float mid = (low + high) / 2.0f;
+			accelPhase(mid, tj, ta, am);
+			if (mid * ta > distance) high = mid; else low = mid;
+		}
+		peakVelocity = low;
+		accelPhase(peakVelocity, tj, ta, am);
+	}
+
+	jerkTime = tj;
+	accelTime = ta;
+	peakAcceleration = am;
+	cruiseTime = peakVelocity > 0.0f ? (distance - peakVelocity * ta) / peakVelocity : 0.0f;
+	if (cruiseTime < 0.0f) cruiseTime = 0.0f;
+	return true;
+}
+
+// Acceleration phase t seconds from rest, in the +ve direction
+MotionPoint Trajectory::fromRest(float t) const
+{
+	float am = peakAcceleration;
+	float tj = jerkTime;
+
+	if (t < tj)
+	{
+		return { jerk * t * t * t / 6.0f, jerk * t * t / 2.0f, jerk * t };
+	}
+	if (t < accelTime - tj)
+	{
+		float v1 = am * tj / 2.0f;
+		float p1 = am * tj * tj / 6.0f;
+		float s = t - tj;
+		return { p1 + v1 * s + am * s * s / 2.0f, v1 + am * s, am };
+	}
+
+	// Last jerk segment mirrors the first
+	float s = accelTime - t;
+	if (s < 0.0f) s = 0.0f;
+	float pa = peakVelocity * accelTime / 2.0f;
+	return { pa - (peakVelocity * s - jerk * s * s * s / 6.0f), peakVelocity - jerk * s * s / 2.0f, jerk * s };
+}
+
+MotionPoint Trajectory::at(float t) const
+{
+	MotionPoint p;
+	float total = duration();
+
+	if (t <= 0.0f) p = { 0.0f, 0.0f, 0.0f };
+	else if (t >= total) p = { distance, 0.0f, 0.0f };
+	else if (t < accelTime) p = fromRest(t);
+	else if (t < accelTime + cruiseTime)
+	{
+		p = { peakVelocity * accelTime / 2.0f + peakVelocity * (t - accelTime), peakVelocity, 0.0f };
+	}
+	else
+	{
+		// Deceleration is the acceleration run backwards from the end
+		MotionPoint r = fromRest(total - t);
+		p = { distance - r.position, r.velocity, -r.acceleration };
+	}
+
+	p.position = start + direction * p.position;
+	p.velocity *= direction;
+	p.acceleration *= direction;
+	return p;
+}
+
+float Trajectory::duration() const
+{
+	return 2.0f * accelTime + cruiseTime;
+}
+
+float Trajectory::getPeakVelocity() const
+{
+	return peakVelocity;
+}
+
+Path::Path()
+{
+}
+
+bool Path::plan(float from, const std::vector<Waypoint>& waypoints, const MotionLimits& limits)
+{
+	times.assign(1, 0.0f);
+	arrivals.clear();
+	positions.assign(1, from);
+	velocities.assign(1, 0.0f);
+	if (limits.velocity <= 0.0f || limits.acceleration <= 0.0f) return false;
+
+	for (const Waypoint& point : waypoints)
+	{
+		if (point.time < 0.0f || point.velocity < 0.0f) return false;
+
+		float distance = std::fabs(point.position - positions.back());
+		float velocity = point.velocity > 0.0f ? std::fmin(point.velocity, limits.velocity) : limits.velocity;
+		float time = point.time > 0.0f ? point.time : distance / velocity;
+		time = std::fmax(time, std::sqrt(PATH_ACCELERATION_MARGIN * distance / limits.acceleration));
+		if (time > 0.0f)
+		{
+			times.push_back(times.back() + time);
+			positions.push_back(point.position);
+			velocities.push_back(0.0f);
+		}
+		arrivals.push_back(times.back()); // already there if no time
+	}
+
+	// Velocity through each inner waypoint from the slopes either side
+	for (size_t i = 1; i + 1 < positions.size(); ++i)
+	{
+		float before = times[i] - times[i - 1];
+		float after = times[i + 1] - times[i];
+		float slopeBefore = (positions[i] - positions[i - 1]) / before;
+		float slopeAfter = (positions[i + 1] - positions[i]) / after;
+		if (slopeBefore * slopeAfter <= 0.0f) continue; // turns back or pauses
+
+		float weightBefore = 2.0f * after + before;
+		float weightAfter = after + 2.0f * before;
+		float velocity = (weightBefore + weightAfter) / (weightBefore / slopeBefore + weightAfter / slopeAfter);
+		velocities[i] = std::fmax(-limits.velocity, std::fmin(limits.velocity, velocity));
+	}
+	return true;
+}
+
+MotionPoint Path::at(float t) const
+{
+	if (t <= 0.0f) return { positions.front(), 0.0f, 0.0f };
+	if (t >= times.back()) return { positions.back(), 0.0f, 0.0f };
+
+	size_t i = 1;
+	while (times[i] < t) ++i;
+
+	// Cubic Hermite between knots i - 1 and i
+	float h = times[i] - times[i - 1];
+	float s = (t - times[i - 1]) / h;
+	float p0 = positions[i - 1], p1 = positions[i];
+	float m0 = velocities[i - 1] * h, m1 = velocities[i] * h;
+	float s2 = s * s, s3 = s2 * s;
+
+	float position = (2.0f * s3 - 3.0f * s2 + 1.0f) * p0 + (s3 - 2.0f * s2 + s) * m0 + (-2.0f * s3 + 3.0f * s2) * p1 + (s3 - s2) * m1;
+	float velocity = ((6.0f * s2 - 6.0f * s) * p0 + (3.0f * s2 - 4.0f * s + 1.0f) * m0 + (-6.0f * s2 + 6.0f * s) * p1 + (3.0f * s2 - 2.0f * s) * m1) / h;
+	float acceleration = ((12.0f * s - 6.0f) * p0 + (6.0f * s - 4.0f) * m0 + (-12.0f * s + 6.0f) * p1 + (6.0f * s - 2.0f) * m1) / (h * h);
+	return { position, velocity, acceleration };
+}
+
+float Path::duration() const
+{
+	return times.back();
+}
+
+float Path::arrival(size_t n) const
+{
+	return n < arrivals.size() ? arrivals[n] : duration();
+}
+
+size_t Path::size() const
+{
+	return arrivals.size();
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <cstddef>
+#include <vector>
+
+/*
+   Time optimal point to point moves.
+
+   A move from rest to rest is limited by a maximum velocity,
+   acceleration and jerk. With jerk 0 the acceleration steps
+   (trapezoidal velocity), otherwise it ramps (S-curve). Short
+   moves never reach the maximum velocity. Units are whatever the
+   caller uses - Wheel plans in degrees and seconds.
+*/
+
+// Defaults for Wheel::moveTo()
+constexpr float PLAN_ACCELERATION = 1500.0f; // deg/S^2
+constexpr float PLAN_JERK = 60000.0f; // deg/S^3 - 0 for trapezoidal
+constexpr auto PLAN_SEARCH_STEPS = 40; // peak velocity bisection on short moves
+constexpr float PATH_ACCELERATION_MARGIN = 6.0f; // peak acceleration of a cubic from rest to rest is 6 d / T^2
+
+struct MotionLimits
+{
+	float velocity;
+	float acceleration;
+	float jerk;
+};
+
+struct MotionPoint
+{
+	float position;
+	float velocity;
+	float acceleration;
+};
+
+class Trajectory
+{
+private:
+	float start;
+	float distance;		// always +ve
+	float direction;	// +1 or -1
+	float jerk;
+	float peakVelocity;
+	float peakAcceleration;
+	float jerkTime;		// each jerk segment
+	float accelTime;	// whole acceleration phase, deceleration mirrors it
+	float cruiseTime;
+
+	void accelPhase(float peak, float& tj, float& ta, float& am) const;
+	MotionPoint fromRest(float t) const;
+
+public:
+	Trajectory();
+
+	// false if the limits cant produce a move
+	bool plan(float from, float to, const MotionLimits& limits);
+
+	// Position, velocity and acceleration t seconds after the start
+	MotionPoint at(float t) const;
+	float duration() const;
+	float getPeakVelocity() const;
+};
+
+/*
+   Continuous paths through waypoints.
+
+   The path starts and ends at rest and passes through each waypoint
+   without stopping - a cubic between each pair of waypoints, joined
+   with matching position and velocity. The velocity at a waypoint
+   is the weighted harmonic mean of the slopes either side, or 0
+   where the path turns back, so it never overshoots a waypoint.
+   Each segment takes the time asked for, or its distance over the
+   velocity asked for, but never less than the acceleration limit
+   allows.
+*/
+
+struct Waypoint
+{
+	float position;
+	float time = 0.0f;		// S from the previous waypoint, 0 to use velocity
+	float velocity = 0.0f;	// mean over the segment, 0 to use the limit
+};
+
+class Path
+{
+private:
+	std::vector<float> times;		// arrival at each knot, the first is the start
+	std::vector<float> positions;
+	std::vector<float> velocities;
+	std::vector<float> arrivals;	// S - one per waypoint
+
+public:
+	Path();
+
+	// false if the limits or a waypoint cant produce a path
+	bool plan(float from, const std::vector<Waypoint>& waypoints, const MotionLimits& limits);
+
+	// Position, velocity and acceleration t seconds after the start
+	MotionPoint at(float t) const;
+	float duration() const;
+
+	// When waypoint n is reached, S after the start
+	float arrival(size_t n) const;
+	size_t size() const; // waypoints
+};
@@ -1,4 +1,7 @@
 #include "Wheel.h"
+#include "Effect.h"
+#include <algorithm>
+#include <cmath>
 
 /*
 Author: Andy Perrett
@@ -8,22 +11,52 @@ Version 0.1
 
 */
 
-Wheel::Wheel(const std::string name, bool debug) : debug(debug), deviceNumber(DEVICE_ERROR), hasHaptic(false)
+Wheel::Wheel(const std::string name, bool debug) : debug(debug), deviceNumber(DEVICE_ERROR), hasHaptic(false),
+	sampling(false), samplePeriod(SAMPLE_PERIOD), sampleCount(0), activeEffects(0), publishing(false),
+	replaying(nullptr), recording(false), virtualTime(0), nextSampleTime(0), replayEffectId(REPLAY_EFFECT_ID),
+	commanding(false), commanderStarted(false), commanderId(std::thread::id()), commandIdle(false), servicing(false), motion(nullptr), progressDepth(0)
 {
 	leftLock = SDL_MAX_SINT16;
 	rightLock = SDL_MIN_SINT16;
 	centre = 0;
 	jitter = 0;
+	lastDriven = 0;
+	instancesDriveUntil = 0;
+	frontScene = 0;
 	hapticGain = EFFECT_ERROR;
-
+	maxGain = MAX_GAIN;
+	updateConversion();
+	capabilities = 0;
+	randomSeed = (unsigned int)time(0);
+	countsPerDegree = (float)(std::abs(leftLock) + std::abs(rightLock)) / DEGREES;
+	clockInit();
+	Uint64 phase = clockNow();
 
 
 
 	// Initialise effect
 	resetEffect();
+	memset(&telemetryForce, 0, sizeof(SDL_HapticEffect));
+	memset(&telemetryTexture, 0, sizeof(SDL_HapticEffect));
+	memset(&trajectoryForce, 0, sizeof(SDL_HapticEffect));
+	memset(&endStopForce, 0, sizeof(SDL_HapticEffect));
+	endStopId = EFFECT_ERROR;
+	samplerSending = false;
+	memset(&streamForce, 0, sizeof(SDL_HapticEffect));
+	streamId = EFFECT_ERROR;
+	streamHolding = false;
+	streamHeld = 0;
+	streamHeldAt = 0;
+	predictionLatency = PREDICT_LATENCY;
+	cacheTopSpeed();
+	realtimeVersion = 0;
+	realtimeRunning[LOOP_SAMPLER] = realtimeRunning[LOOP_CONTROL] = false;
+	controlSpin = CLOCK_SPIN;
 
 	//Initialize SDL
-	if (SDL_Init(SDL_INIT_JOYSTICK | SDL_INIT_HAPTIC) < 0)
+	int initialised = SDL_Init(SDL_INIT_JOYSTICK | SDL_INIT_HAPTIC);
+	startupPhase(startup.init, phase);
+	if (initialised < 0)
 	{
 		deviceNumber = DEVICE_ERROR;
 		log("Could not initialise SDL Joystick or SDL Haptic system. (" + std::string(SDL_GetError()) + ")");
@@ -68,10 +101,19 @@ Wheel::Wheel(const std::string name, bool debug) : debug(debug), deviceNumber(DE
 
 				// Open joystick
 				joy = SDL_JoystickOpen(deviceNumber);
+				startupPhase(startup.open, phase);
 
 				if (deviceNumber > DEVICE_ERROR) testHapticAbilitiy();
+				startupPhase(startup.haptic, phase);
+
+				// The driver may be centring the wheel - carry on once
+				// it has been still for STARTUP_SETTLE_HOLD
 				log("Waiting for device to settle");
-				wait(7000); // TODO Driver may be moving wheel - perhaps test if moving?
+				settle.configure(SETTLE_AUTO_BAND, STARTUP_SETTLE_HOLD);
+				startup.settled = startSampler() && waitSettled(STARTUP_SETTLE_TIMEOUT);
+				settle.configure(SETTLE_AUTO_BAND, SETTLE_HOLD);
+				startupPhase(startup.settle, phase);
+				if (!startup.settled) log("Error: Device still moving after " + std::to_string(STARTUP_SETTLE_TIMEOUT) + " mS");
 
 				if (debug)
 				{
@@ -104,6 +146,68 @@ Wheel::Wheel(const std::string name, bool debug) : debug(debug), deviceNumber(DE
 	// Set gain to max (it may be scalled by SDL_HAPTIC_GAIN_MAX)
 	setMaxGain(100);
 	setGain(100);
+	startupPhase(startup.gain, phase);
+
+	startup.total = startup.init + startup.open + startup.haptic + startup.settle + startup.gain;
+	log("Startup: init " + std::to_string(startup.init / NS_PER_MS) + " mS, open " + std::to_string(startup.open / NS_PER_MS)
+		+ " mS, haptic " + std::to_string(startup.haptic / NS_PER_MS) + " mS, settle " + std::to_string(startup.settle / NS_PER_MS)
+		+ " mS, gain " + std::to_string(startup.gain / NS_PER_MS) + " mS, total " + std::to_string(startup.total / NS_PER_MS) + " mS");
+}
+
+// Time since the last phase ended
+void Wheel::startupPhase(Uint64& duration, Uint64& phase)
+{
+	Uint64 t = clockNow();
+	duration = t - phase;
+	phase = t;
+}
+
+StartupTiming Wheel::getStartupTiming()
+{
+	return startup;
+}
+
+// Replay a recorded session. No device is opened - positions and
+// command results come from the session and time is virtual.
+Wheel::Wheel(Session& session, bool debug) : debug(debug), deviceNumber(0), hasHaptic(true),
+	sampling(false), samplePeriod(SAMPLE_PERIOD), sampleCount(0), activeEffects(0), publishing(false),
+	replaying(&session), recording(false), virtualTime(0), nextSampleTime(0), replayEffectId(REPLAY_EFFECT_ID),
+	commanding(false), commanderStarted(false), commanderId(std::thread::id()), commandIdle(false), servicing(false), motion(nullptr), progressDepth(0)
+{
+	session.rewind();
+	leftLock = session.leftLock;
+	rightLock = session.rightLock;
+	centre = session.centre;
+	jitter = session.jitter;
+	lastDriven = 0;
+	instancesDriveUntil = 0;
+	frontScene = 0;
+	hapticGain = session.gain;
+	maxGain = MAX_GAIN;
+	capabilities = session.capabilities;
+	updateConversion();
+	randomSeed = session.seed;
+	countsPerDegree = (float)(std::abs(leftLock) + std::abs(rightLock)) / DEGREES;
+
+	resetEffect();
+	memset(&telemetryForce, 0, sizeof(SDL_HapticEffect));
+	memset(&telemetryTexture, 0, sizeof(SDL_HapticEffect));
+	memset(&trajectoryForce, 0, sizeof(SDL_HapticEffect));
+	memset(&endStopForce, 0, sizeof(SDL_HapticEffect));
+	endStopId = EFFECT_ERROR;
+	samplerSending = false;
+	memset(&streamForce, 0, sizeof(SDL_HapticEffect));
+	streamId = EFFECT_ERROR;
+	streamHolding = false;
+	streamHeld = 0;
+	streamHeldAt = 0;
+	predictionLatency = PREDICT_LATENCY;
+	cacheTopSpeed();
+	realtimeVersion = 0;
+	realtimeRunning[LOOP_SAMPLER] = realtimeRunning[LOOP_CONTROL] = false;
+	controlSpin = CLOCK_SPIN;
+
+	log("Replaying session");
 }
 
 // Any and all effects that are uploaded are deleted
@@ -113,6 +217,9 @@ void Wheel::destroyAllEffects()
 	{
 		destroyEffect(i);
 	}
+	releaseAllEffects();
+	clearEndStops();
+	stopForceStream();
 }
 
 // Destructor - cleanup
@@ -120,6 +227,11 @@ Wheel::~Wheel()
 {
 	log("Wheel destructor");
 
+	// Clean up is not part of a recorded or replayed session
+	stopCommands();
+	stopSampler();
+	stopRecording();
+
 	if (haptic != NULL)
 	{
 		SDL_HapticClose(haptic);
@@ -133,6 +245,8 @@ Wheel::~Wheel()
 		joy = nullptr;
 	}
 
+	if (replaying != nullptr) return;
+
 	// TODO Mutliple joysticks will cause an issue here
 	SDL_QuitSubSystem(SDL_INIT_HAPTIC);
 	SDL_QuitSubSystem(SDL_INIT_JOYSTICK);
@@ -180,29 +294,42 @@ void Wheel::log(std::string msg, int place)
 // Read x axis of wheel
 Sint16 Wheel::getPosition()
 {
-	SDL_JoystickUpdate();
-	int position = SDL_JoystickGetAxis(joy, 0);
+	int position = deviceAxis();
 	//log("Position: " + std::to_string(p));
 	return position;
 }
 
+// Whole degrees, towards zero
 Sint16 Wheel::calculateAngle(Sint16 position)
 {
-	Uint16 range = std::abs(leftLock) + std::abs(rightLock);
-	return (Sint16)((position + OFFSET) / (float)(range / DEGREES));
+	return (Sint16)(calculateAngleMd(position) / MDEG_PER_DEGREE);
 }
 
 // Calculate position from angle
 Sint16 Wheel::calculatePosition(float angle)
 {
-	Uint16 range = std::abs(leftLock) + std::abs(rightLock);
-	return (Sint16)(angle * (float)(range / DEGREES));
+	return calculatePositionMd((Sint32)std::lround(angle * MDEG_PER_DEGREE));
 }
 
 Sint16 Wheel::getAngle()
 {
-	Uint16 range = std::abs(leftLock) + std::abs(rightLock);
-	return (Sint16)((getPosition() + OFFSET) / (float)(range / DEGREES));
+	return (Sint16)(getAngleMd() / MDEG_PER_DEGREE);
+}
+
+Sint32 Wheel::calculateAngleMd(Sint16 position)
+{
+	return (Sint32)std::lround((position + OFFSET) * (float)MDEG_PER_DEGREE / countsPerDegree);
+}
+
+Sint16 Wheel::calculatePositionMd(Sint32 angleMd)
+{
+	long position = std::lround(angleMd * countsPerDegree / MDEG_PER_DEGREE);
+	return (Sint16)std::min(std::max(position, (long)SDL_MIN_SINT16), (long)SDL_MAX_SINT16);
+}
+
+Sint32 Wheel::getAngleMd()
+{
+	return calculateAngleMd(getPosition());
 }
 
 bool Wheel::stopEffect(int effect)
@@ -219,12 +346,21 @@ bool Wheel::stopEffect(int effect)
 		return false;
 	}
 
-	int result = SDL_HapticStopEffect(haptic, effectsMap[effect]);
+	// Only runEffect() starts effects so a clear bit is certain
+	if (!((activeEffects >> effect) & 1))
+	{
+		effectStats.stopsElided++;
+		return true;
+	}
+
+	effectStats.stops++;
+	int result = deviceStop(effect, effectsMap[effect]);
 	if (result != 0)
 	{
 		log("Error: Could not stop (" + effectsName[effect] + ") - " + SDL_GetError());
 		return false;
 	}
+	activeEffects &= ~(1u << effect);
 	log("Effect (" + effectsName[effect] + ") stopped");
 	return true;
 }
@@ -243,11 +379,347 @@ bool Wheel::isEffectRunning(int effect)
 		return false;
 	}
 
-	int result = SDL_HapticGetEffectStatus(haptic, effectsMap[effect]);
+	// Answer from the model unless a timed run is close to its end
+	Uint32 bit = 1u << effect;
+	if (!(activeEffects & bit))
+	{
+		effectStats.queriesElided++;
+		return false;
+	}
+	Uint64 end = shadows[effect].ends;
+	Uint64 t = now();
+	if (end == 0 || t + EFFECT_END_MARGIN * NS_PER_MS < end)
+	{
+		effectStats.queriesElided++;
+		return true;
+	}
+	if (t > end + EFFECT_END_MARGIN * NS_PER_MS || !canGetStatus())
+	{
+		effectStats.queriesElided++;
+		if (t < end) return true;
+		activeEffects &= ~bit;
+		return false;
+	}
+
+	effectStats.queries++;
+	int result = deviceStatus(effect, effectsMap[effect]);
 	if (result == 1) return true;
+	if (result == 0) activeEffects &= ~bit;
 	return false;
 }
 
+// When a run started at start ends - 0 if it doesn't
+Uint64 Wheel::effectEnd(const SDL_HapticEffect& e, Uint64 start, Uint32 iterations)
+{
+	Uint32 length, delay;
+	switch (e.type)
+	{
+	case SDL_HAPTIC_CONSTANT: length = e.constant.length; delay = e.constant.delay; break;
+	case SDL_HAPTIC_RAMP: length = e.ramp.length; delay = e.ramp.delay; break;
+	case SDL_HAPTIC_SPRING:
+	case SDL_HAPTIC_DAMPER:
+	case SDL_HAPTIC_INERTIA:
+	case SDL_HAPTIC_FRICTION: length = e.condition.length; delay = e.condition.delay; break;
+	default: length = e.periodic.length; delay = e.periodic.delay;
+	}
+	if (length == FOREVER || iterations == SDL_HAPTIC_INFINITY) return 0;
+	return start + (Uint64)(length + delay) * iterations * NS_PER_MS;
+}
+
+EffectStats Wheel::getEffectStats()
+{
+	return effectStats;
+}
+
+EffectHandle Wheel::createEffect(const EffectDescriptor& descriptor)
+{
+	if (!descriptor.valid())
+	{
+		log("Error: (createEffect) " + std::string(descriptor.error));
+		return EffectHandle();
+	}
+
+	descriptor.fill(effect);
+	EffectHandle handle = pool.add(effect);
+	if (!makeResident(handle.id, *pool.find(handle)))
+	{
+		pool.remove(handle);
+		return EffectHandle();
+	}
+	return handle;
+}
+
+// New parameters - a playing effect is updated in place and keeps playing
+bool Wheel::updateEffect(EffectHandle handle, const EffectDescriptor& descriptor)
+{
+	EffectInstance* instance = pool.find(handle);
+	if (instance == nullptr || !descriptor.valid())
+	{
+		log("Error: (updateEffect) " + std::string(instance == nullptr ? "Bad handle" : descriptor.error));
+		return false;
+	}
+
+	descriptor.fill(effect);
+	if (memcmp(&instance->params, &effect, sizeof(SDL_HapticEffect)) == 0)
+	{
+		effectStats.uploadsElided++;
+		return true;
+	}
+
+	// Not on the device - uploaded when next run
+	bool sameType = instance->params.type == effect.type;
+	instance->params = effect;
+	if (instance->deviceId == NOT_RESIDENT) return true;
+
+	if (!sameType)
+	{
+		evict(handle.id);
+		return makeResident(handle.id, *instance);
+	}
+
+	effectStats.uploads++;
+	if (deviceUpdate(INSTANCE_TYPE + handle.id, instance->deviceId, &instance->params) != 0)
+	{
+		log("Error: (updateEffect) " + std::string(SDL_GetError()));
+		return false;
+	}
+	if (instance->playing) instance->ends = effectEnd(instance->params, now(), 1);
+	return true;
+}
+
+bool Wheel::runEffect(EffectHandle handle, Uint32 iterations)
+{
+	EffectInstance* instance = pool.find(handle);
+	if (instance == nullptr || !checkIterations(iterations))
+	{
+		log("Error: (runEffect) Bad handle");
+		return false;
+	}
+
+	// Already playing for ever - running it again changes nothing
+	if (instance->playing && instance->ends == 0)
+	{
+		effectStats.runsElided++;
+		return true;
+	}
+
+	if (!makeResident(handle.id, *instance)) return false;
+
+	effectStats.runs++;
+	if (deviceRun(INSTANCE_TYPE + handle.id, instance->deviceId, iterations) != 0)
+	{
+		log("Error: (runEffect) " + std::string(SDL_GetError()));
+		return false;
+	}
+
+	Uint64 t = now();
+	instance->playing = true;
+	instance->ends = effectEnd(instance->params, t, iterations);
+	instancesDriveUntil = pool.driveUntil(t);
+	return true;
+}
+
+bool Wheel::stopEffect(EffectHandle handle)
+{
+	EffectInstance* instance = pool.find(handle);
+	if (instance == nullptr)
+	{
+		log("Error: (stopEffect) Bad handle");
+		return false;
+	}
+
+	if (!instance->playing || instance->deviceId == NOT_RESIDENT)
+	{
+		effectStats.stopsElided++;
+		return true;
+	}
+
+	effectStats.stops++;
+	if (deviceStop(INSTANCE_TYPE + handle.id, instance->deviceId) != 0)
+	{
+		log("Error: (stopEffect) " + std::string(SDL_GetError()));
+		return false;
+	}
+
+	instance->playing = false;
+	instancesDriveUntil = pool.driveUntil(now());
+	return true;
+}
+
+// From the model - timed runs are over when their time is up
+bool Wheel::isEffectRunning(EffectHandle handle)
+{
+	EffectInstance* instance = pool.find(handle);
+	effectStats.queriesElided++;
+	return instance != nullptr && !pool.isIdle(*instance, now());
+}
+
+void Wheel::releaseEffect(EffectHandle handle)
+{
+	EffectInstance* instance = pool.find(handle);
+	if (instance == nullptr) return;
+
+	if (instance->deviceId != NOT_RESIDENT) deviceDestroy(INSTANCE_TYPE + handle.id, instance->deviceId);
+	pool.remove(handle);
+	instancesDriveUntil = pool.driveUntil(now());
+}
+
+void Wheel::releaseAllEffects()
+{
+	for (auto& i : pool.all())
+	{
+		if (i.second.deviceId != NOT_RESIDENT) deviceDestroy(INSTANCE_TYPE + i.first, i.second.deviceId);
+	}
+	pool.clear();
+	scenes[0].clear();
+	scenes[1].clear();
+	instancesDriveUntil = 0;
+	frontScene = 0;
+}
+
+int Wheel::getEffectCapacity()
+{
+	return pool.getCapacity();
+}
+
+// Fill the back scene - its handles are reused and kept on the device
+bool Wheel::prepareScene(const std::vector<EffectDescriptor>& effects)
+{
+	for (const EffectDescriptor& d : effects)
+	{
+		if (!d.valid())
+		{
+			log("Error: (prepareScene) " + std::string(d.error));
+			return false;
+		}
+	}
+
+	std::vector<EffectHandle>& back = scenes[1 - frontScene];
+	while (back.size() > effects.size())
+	{
+		releaseEffect(back.back());
+		back.pop_back();
+	}
+
+	for (size_t i = 0; i < effects.size(); ++i)
+	{
+		if (i == back.size())
+		{
+			EffectHandle handle = createEffect(effects[i]);
+			if (!handle.valid()) return false;
+			pool.find(handle)->pinned = true;
+			back.push_back(handle);
+			continue;
+		}
+
+		EffectInstance* instance = pool.find(back[i]);
+		if (!updateEffect(back[i], effects[i]) || !makeResident(back[i].id, *instance)) return false;
+	}
+	return true;
+}
+
+// Stop the front scene and run the back one. Paused, nothing the
+// driver does in between reaches the wheel.
+bool Wheel::swapScene(bool stopNumbered)
+{
+	std::vector<EffectHandle>& front = scenes[frontScene];
+	std::vector<EffectHandle>& back = scenes[1 - frontScene];
+
+	bool paused = canPause() && devicePause(true) == 0;
+
+	bool ok = true;
+	for (EffectHandle handle : front) if (!stopEffect(handle)) ok = false;
+	if (stopNumbered)
+	{
+		for (unsigned int i = MIN_EFFECT_NUMBER; i <= MAX_EFFECT_NUMBER; i++)
+		{
+			if ((activeEffects >> i) & 1) stopEffect(i);
+		}
+	}
+	for (EffectHandle handle : back) if (!runEffect(handle)) ok = false;
+
+	if (paused && devicePause(false) != 0)
+	{
+		log("Error: (swapScene) " + std::string(SDL_GetError()));
+		ok = false;
+	}
+
+	frontScene = 1 - frontScene;
+	return ok;
+}
+
+void Wheel::clearScenes()
+{
+	for (std::vector<EffectHandle>& scene : scenes)
+	{
+		for (EffectHandle handle : scene) releaseEffect(handle);
+		scene.clear();
+	}
+}
+
+// Upload an instance if it isn't on the device, making room if the
+// device is full. The numbered effects count against the room.
+bool Wheel::makeResident(Uint32 handle, EffectInstance& instance)
+{
+	if (instance.deviceId != NOT_RESIDENT) return true;
+
+	int id = deviceNewWithRoom(INSTANCE_TYPE + handle, &instance.params);
+	if (id < 0)
+	{
+		log("Error: (makeResident) " + std::string(SDL_GetError()));
+		return false;
+	}
+	instance.deviceId = id;
+	instance.playing = false;
+	return true;
+}
+
+// Upload anything - handles, numbered effects, the trajectory, stream,
+// end-stop and telemetry forces -
+// evicting the least recently used idle handle when the device is full
+// by the books, or refuses the upload anyway
+int Wheel::deviceNewWithRoom(unsigned int type, SDL_HapticEffect* e)
+{
+	int used = pool.resident();
+	for (const auto& m : effectsMap) if (m.second != EFFECT_ERROR) ++used;
+	if (streamId != EFFECT_ERROR) ++used; // sampler's own effects
+	if (endStopId != EFFECT_ERROR) ++used;
+
+	Uint64 t = now();
+	for (int attempt = 0; attempt < 2; ++attempt)
+	{
+		if (used >= pool.getCapacity() || attempt > 0)
+		{
+			Uint32 oldest = pool.victim(t);
+			if (oldest == 0)
+			{
+				log("Error: No room on the device for another effect");
+				return EFFECT_ERROR;
+			}
+			evict(oldest);
+			--used;
+		}
+
+		effectStats.uploads++;
+		int id = deviceNew(type, e);
+		if (id >= 0) return id;
+	}
+	return EFFECT_ERROR;
+}
+
+// Take an instance off the device - its parameters are kept
+void Wheel::evict(Uint32 handle)
+{
+	EffectHandle h;
+	h.id = handle;
+	EffectInstance* instance = pool.find(h);
+	if (instance == nullptr || instance->deviceId == NOT_RESIDENT) return;
+
+	deviceDestroy(INSTANCE_TYPE + handle, instance->deviceId);
+	instance->deviceId = NOT_RESIDENT;
+	instance->playing = false;
+}
+
 // Tests to see if Joystick / wheel has haptic abilities
 // Sets "hasHaptic" to true or false
 void Wheel::testHapticAbilitiy()
@@ -259,7 +731,13 @@ void Wheel::testHapticAbilitiy()
 	// if ((device_index < 0) || (device_index >= SDL_numhaptics))
 	// ie, deviceID = 1 matches numhaptics = 1
 	haptic = SDL_HapticOpenFromJoystick(joy);
-	if (haptic != NULL) hasHaptic = true;
+	if (haptic != NULL)
+	{
+		hasHaptic = true;
+		capabilities = SDL_HapticQuery(haptic); // doesn't change while open
+		int slots = SDL_HapticNumEffects(haptic);
+		if (slots > 0) pool.setCapacity(slots);
+	}
 }
 
 // Test for Sine wave haptic ability
@@ -267,7 +745,7 @@ bool Wheel::hasSine()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_SINE) return true;
+		if (deviceQuery() & SDL_HAPTIC_SINE) return true;
 	}
 	return false;
 }
@@ -277,7 +755,7 @@ bool Wheel::hasConstant()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_CONSTANT) return true;
+		if (deviceQuery() & SDL_HAPTIC_CONSTANT) return true;
 	}
 	return false;
 }
@@ -287,7 +765,7 @@ bool Wheel::hasLeftRight()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_LEFTRIGHT) return true;
+		if (deviceQuery() & SDL_HAPTIC_LEFTRIGHT) return true;
 	}
 	return false;
 }
@@ -297,7 +775,7 @@ bool Wheel::hasTriangle()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_TRIANGLE) return true;
+		if (deviceQuery() & SDL_HAPTIC_TRIANGLE) return true;
 	}
 	return false;
 }
@@ -307,7 +785,7 @@ bool Wheel::hasSawUp()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_SAWTOOTHUP) return true;
+		if (deviceQuery() & SDL_HAPTIC_SAWTOOTHUP) return true;
 	}
 	return false;
 }
@@ -317,7 +795,7 @@ bool Wheel::hasSawDown()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_SAWTOOTHDOWN) return true;
+		if (deviceQuery() & SDL_HAPTIC_SAWTOOTHDOWN) return true;
 	}
 	return false;
 }
@@ -327,7 +805,7 @@ bool Wheel::hasRamp()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_RAMP) return true;
+		if (deviceQuery() & SDL_HAPTIC_RAMP) return true;
 	}
 	return false;
 }
@@ -337,7 +815,7 @@ bool Wheel::hasSpring()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_SPRING) return true;
+		if (deviceQuery() & SDL_HAPTIC_SPRING) return true;
 	}
 	return false;
 }
@@ -347,7 +825,7 @@ bool Wheel::hasDamper()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_DAMPER) return true;
+		if (deviceQuery() & SDL_HAPTIC_DAMPER) return true;
 	}
 	return false;
 }
@@ -357,7 +835,7 @@ bool Wheel::hasInertia()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_INERTIA) return true;
+		if (deviceQuery() & SDL_HAPTIC_INERTIA) return true;
 	}
 	return false;
 }
@@ -367,7 +845,7 @@ bool Wheel::hasFriction()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_FRICTION) return true;
+		if (deviceQuery() & SDL_HAPTIC_FRICTION) return true;
 	}
 	return false;
 }
@@ -377,7 +855,7 @@ bool Wheel::hasCustom()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_CUSTOM) return true;
+		if (deviceQuery() & SDL_HAPTIC_CUSTOM) return true;
 	}
 	return false;
 }
@@ -387,7 +865,7 @@ bool Wheel::canSetGain()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_GAIN) return true;
+		if (deviceQuery() & SDL_HAPTIC_GAIN) return true;
 	}
 	return false;
 }
@@ -397,7 +875,7 @@ bool Wheel::hasAutoCentre()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_AUTOCENTER) return true;
+		if (deviceQuery() & SDL_HAPTIC_AUTOCENTER) return true;
 	}
 	return false;
 }
@@ -407,7 +885,7 @@ bool Wheel::canGetStatus()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_STATUS) return true;
+		if (deviceQuery() & SDL_HAPTIC_STATUS) return true;
 	}
 	return false;
 }
@@ -417,7 +895,7 @@ bool Wheel::canPause()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticQuery(haptic) & SDL_HAPTIC_PAUSE) return true;
+		if (deviceQuery() & SDL_HAPTIC_PAUSE) return true;
 	}
 	return false;
 }
@@ -427,7 +905,7 @@ bool Wheel::hasRumble()
 {
 	if (hasHaptic)
 	{
-		if (SDL_HapticRumbleSupported(haptic)) return true;
+		if (haptic != nullptr && SDL_HapticRumbleSupported(haptic) == SDL_TRUE) return true;
 	}
 	return false;
 }
@@ -445,7 +923,17 @@ bool Wheel::validHaptic()
 
 int Wheel::numEffectsPlaying()
 {
-	if (hasHaptic) return SDL_HapticNumEffectsPlaying(haptic);
+	if (replaying != nullptr)
+	{
+		int playing = 0;
+		for (Uint32 bits = activeEffects; bits != 0; bits &= bits - 1) ++playing;
+		return playing;
+	}
+	if (hasHaptic)
+	{
+		std::lock_guard<std::mutex> lock(hapticLock);
+		return SDL_HapticNumEffectsPlaying(haptic);
+	}
 	return EFFECT_ERROR;
 }
 
@@ -525,7 +1013,8 @@ bool Wheel::checkIterations(Uint32 iterations)
 // Level must be between range
 bool Wheel::checkLevel(Uint16 level)
 {
-	if (level < MIN_LEVEL || level > SDL_MAX_UINT16)
+	// Sent as a Sint16 - above MAX it would push the other way
+	if (level < MIN_LEVEL || level > MAX)
 	{
 		log("Error: level Out of Bounds");
 		return false;
@@ -635,7 +1124,7 @@ bool Wheel::checkEffectNumber(unsigned int effect)
 // Is there a haptic device?
 bool Wheel::checkHaptic()
 {
-	if (haptic == nullptr)
+	if (haptic == nullptr && replaying == nullptr)
 	{
 		log("Error: haptic not set");
 		return false;
@@ -665,7 +1154,7 @@ int Wheel::setGain(int gain)
 		log("Error: Gain not set");
 		return EFFECT_ERROR;
 	}
-	int result = SDL_HapticSetGain(haptic, gain);
+	int result = deviceGain(gain);
 	if (result != 0)
 	{
 		log("Error: (setGain) " + std::string(SDL_GetError()));
@@ -673,6 +1162,7 @@ int Wheel::setGain(int gain)
 	}
 
 	hapticGain = gain;
+	updateConversion();
 
 	return 0;
 }
@@ -694,43 +1184,15 @@ int Wheel::getGain()
 }
 
 
-// Report SDL_HAPTIC_GAIN_MAX environmental variable
+// Report SDL_HAPTIC_GAIN_MAX as last set
 int Wheel::getMaxGain()
 {
-	log("Getting max gain");
-	const char* maxGain = getenv("SDL_HAPTIC_GAIN_MAX");
-	if (maxGain == NULL)
-	{
-		log("Error: SDL_HAPTIC_GAIN_MAX not set");
-		return -1;
-	}
-
-	int envMaxGain;
-	std::stringstream maxGainStr;
-	maxGainStr << maxGain;
-
-	log("SDL_HAPTIC_GAIN_MAX = " + maxGainStr.str());
-	maxGainStr >> envMaxGain;
-
-	return envMaxGain;
-}
-
-
-// https://stackoverflow.com/questions/17258029/c-setenv-undefined-identifier-in-visual-studio
-// Bill Weinman
-// Set environmental variable name with value
-int Wheel::setenv(const char* name, const char* value, int overwrite)
-{
-	int errcode = 0;
-	if (!overwrite) {
-		size_t envsize = 0;
-		errcode = getenv_s(&envsize, NULL, 0, name);
-		if (errcode || envsize) return errcode;
-	}
-	return _putenv_s(name, value);
+	log("SDL_HAPTIC_GAIN_MAX = " + std::to_string(maxGain));
+	return maxGain;
 }
 
-// Set max gain SDL_HAPTIC_GAIN_MAX.
+// Set max gain SDL_HAPTIC_GAIN_MAX. SDL reads it when the gain is
+// set so the current gain is sent again.
 bool Wheel::setMaxGain(int gain)
 {
 	log("Setting MAX gain to: " + std::to_string(gain));
@@ -741,40 +1203,64 @@ bool Wheel::setMaxGain(int gain)
 		return false;
 	}
 
-	std::string s = std::to_string(gain);
-	MAXIMUM_GAIN = s.c_str();
-	int result = setenv("SDL_HAPTIC_GAIN_MAX", MAXIMUM_GAIN, 1);
-
-	if (result != 0)
+	// SDL keeps its own copy
+	if (SDL_setenv("SDL_HAPTIC_GAIN_MAX", std::to_string(gain).c_str(), 1) != 0)
 	{
 		log("Error: Cant set environment variable SDL_HAPTIC_GAIN_MAX");
 		return false;
 	}
 
+	maxGain = gain;
+	updateConversion();
+	if (hapticGain != EFFECT_ERROR && deviceGain(hapticGain) != 0) log("Error: (setMaxGain) " + std::string(SDL_GetError()));
+
 	return true;
 }
 
+// Level <-> force factors - only change with the gains
+void Wheel::updateConversion()
+{
+	double gain = hapticGain == EFFECT_ERROR ? 100.0 : hapticGain;
+	double scale = (maxGain / 100.0) * (gain / 100.0);
+	levelToForce = scale * RATED_HAPTIC_FORCE / MAX;
+	forceToLevel = scale > 0 ? MAX / (RATED_HAPTIC_FORCE * scale) : 0.0;
+}
+
 // Destroy current effect if exists
 void Wheel::destroyEffect(unsigned int effect)
 {
 	if (effectsMap[effect] != EFFECT_ERROR && checkEffectNumber(effect))
 	{
 		log("Destroying effect: " + effectsName[effect] + " with effect ID: " + std::to_string(effectsMap[effect]));
-		SDL_HapticDestroyEffect(haptic, effectsMap[effect]);
+		deviceDestroy(effect, effectsMap[effect]);
 		effectsMap[effect] = EFFECT_ERROR;
+		activeEffects &= ~(1u << effect);
 		return;
 	}
 
 	if (!checkEffectNumber(effect)) log("Error: Cant destroy effect (" + effectsName[effect] + ")");
 }
 
-// Upload effect to haptic controller
-int Wheel::uploadEffect()
+// Upload effect to haptic controller - replaces the one in the slot
+// unless it is exactly the same
+int Wheel::uploadEffect(unsigned int type)
 {
+	int id = effectsMap[type];
+	if (id != EFFECT_ERROR && memcmp(&shadows[type].params, &effect, sizeof(SDL_HapticEffect)) == 0)
+	{
+		// A fresh upload would only have stopped it
+		effectStats.uploadsElided++;
+		if (((activeEffects >> type) & 1) && deviceStop(type, id) == 0) activeEffects &= ~(1u << type);
+		return id;
+	}
+
+	destroyEffect(type);
 	log("Uploading effect");
 
 	// Upload the effect
-	return SDL_HapticNewEffect(haptic, &effect);
+	id = deviceNewWithRoom(type, &effect);
+	if (id >= 0) shadows[type].params = effect;
+	return id;
 }
 
 bool Wheel::checkParamsConstant(Uint32 mS, Uint16 lvl)
@@ -850,13 +1336,12 @@ bool Wheel::setRightWithEnv(Uint32 mS, Uint16 lvl, Uint32 dly, Uint32 aLen, Uint
 	Outputs to console errors if found */
 bool Wheel::setConstantForce(Uint32 mS, Uint16 lvl, int dir, Uint32 dly, Uint32 aLen, Uint16 aLvl, Uint32 fLen, Uint16 fLvl)
 {
-	destroyEffect(dir);
-
 	log("Setting up Constant Force Effect");
 
 	if (!hasConstant())
 	{
 		log("Error: Does not have constant ability");
+		destroyEffect(dir);
 		return false;
 	}
 
@@ -876,7 +1361,7 @@ bool Wheel::setConstantForce(Uint32 mS, Uint16 lvl, int dir, Uint32 dly, Uint32
 	effect.constant.fade_length = fLen;
 	effect.constant.fade_level = scaleLevel(fLvl);
 
-	int effect_id = uploadEffect();
+	int effect_id = uploadEffect(dir);
 
 	// error?
 	if (effect_id < 0)
@@ -1091,8 +1576,6 @@ void Wheel::setConditionType(int type, int& sdl_type)
 	Outputs to console errors if found */
 bool Wheel::setPeriod(unsigned int type, Uint32 mS, Uint32 period, Sint16 offset, Uint16 phase, Uint16 lvl, int dir, Uint32 dly, Uint32 aLen, Uint16 aLvl, Uint32 fLen, Uint16 fLvl)
 {
-	destroyEffect(type);
-
 	log("Setting up " + std::string(effectsName[type]) + " Effect");
 
 	int left_right, up_down, sdl_type;
@@ -1122,7 +1605,7 @@ bool Wheel::setPeriod(unsigned int type, Uint32 mS, Uint32 period, Sint16 offset
 	effect.periodic.fade_length = fLen;
 	effect.periodic.fade_level = scaleLevel(fLvl);
 
-	int effect_id = uploadEffect();
+	int effect_id = uploadEffect(type);
 
 	// error?
 	if (effect_id < 0)
@@ -1228,13 +1711,13 @@ bool Wheel::setFriction(Uint32 mS, Uint32 dly, Uint16 rSat, Uint16 lSat, Sint16
 	*/
 bool Wheel::setCondition(unsigned int type, Uint32 mS, Uint32 dly, Uint16 rSat, Uint16 lSat, Sint16 rCo, Sint16 lCo, Uint16 dead, Sint16 centre)
 {
-	destroyEffect(type);
-
 	log("Setting up " + std::string(effectsName[type]) + " Effect");
 
 	int sdl_type;
 	setConditionType(type, sdl_type);
 
+	resetEffect();
+
 	// SDL_HAPTIC_DAMPER FRICTION INERTIA and SPRING
 	effect.type = sdl_type;
 	effect.condition.direction.type = DIRECTION_TYPE;
@@ -1254,7 +1737,7 @@ bool Wheel::setCondition(unsigned int type, Uint32 mS, Uint32 dly, Uint16 rSat,
 		effect.condition.center[axis] = centre;
 	}
 
-	int effect_id = uploadEffect();
+	int effect_id = uploadEffect(type);
 
 	// error?
 	if (effect_id < 0)
@@ -1306,13 +1789,12 @@ bool Wheel::setRampForce(Uint32 mS, int dir, Uint32 dly, Sint16 start, Sint16 en
 {
 	if (!checkRampType(type)) return false;
 
-	destroyEffect(type);
-
 	log("Setting up Ramp Effect");
 
 	if (!hasRamp())
 	{
 		log("Error: Does not have ramp ability");
+		destroyEffect(type);
 		return false;
 	}
 
@@ -1336,7 +1818,7 @@ bool Wheel::setRampForce(Uint32 mS, int dir, Uint32 dly, Sint16 start, Sint16 en
 	effect.ramp.fade_length = fLen;
 	effect.ramp.fade_level = scaleLevel(fLvl);
 
-	int effect_id = uploadEffect();
+	int effect_id = uploadEffect(type);
 
 	// error?
 	if (effect_id < 0)
@@ -1354,17 +1836,75 @@ bool Wheel::setRampForce(Uint32 mS, int dir, Uint32 dly, Sint16 start, Sint16 en
 } // end setConstantForce
 
 
+// Upload a prebuilt descriptor. It was checked when it was built so
+// nothing is checked or logged here unless the device refuses it.
+// An uploaded effect of the same type is updated in place and keeps
+// running - not sent at all if nothing has changed.
+bool Wheel::setEffect(const EffectDescriptor& descriptor)
+{
+	if (!descriptor.valid())
+	{
+		log("Error: (setEffect) " + std::string(descriptor.error));
+		return false;
+	}
+
+	unsigned int slot = descriptor.slot;
+	descriptor.fill(effect);
+
+	int id = effectsMap[slot];
+	if (id != EFFECT_ERROR && shadows[slot].params.type == descriptor.type)
+	{
+		if (memcmp(&shadows[slot].params, &effect, sizeof(SDL_HapticEffect)) == 0)
+		{
+			effectStats.uploadsElided++;
+			return true;
+		}
+
+		effectStats.uploads++;
+		if (deviceUpdate(slot, id, &effect) != 0) return false;
+		shadows[slot].params = effect;
+
+		// A new length counts from the update
+		if ((activeEffects >> slot) & 1) shadows[slot].ends = effectEnd(effect, now(), 1);
+		return true;
+	}
+
+	id = uploadEffect(slot);
+	if (id < 0)
+	{
+		effectsMap[slot] = EFFECT_ERROR;
+		log("Error: (setEffect) " + std::string(SDL_GetError()));
+		return false;
+	}
+
+	effectsMap[slot] = id;
+	return true;
+}
+
 // Wait / pause / delay for number of milli seconds
 void Wheel::wait(Uint32 mS)
 {
 	log("Waiting for " + std::to_string(mS) + " milli Seconds");
-	SDL_Delay(mS);
+	waitNoLog(mS);
 }
 
 // Wait / pause / delay for number of milli seconds
 void Wheel::waitNoLog(Uint32 mS)
 {
-	SDL_Delay(mS);
+	if (replaying != nullptr)
+	{
+		advance(mS * NS_PER_MS);
+		return;
+	}
+
+	// In slices so an async call can be cancelled - only the last one
+	// ends on the deadline, so only it spins
+	Uint64 end = now() + mS * NS_PER_MS;
+	while (!cancelled() && now() < end)
+	{
+		Uint64 slice = std::min(end, now() + MOTION_POLL * NS_PER_MS);
+		sleepUntil(slice, slice == end ? waitSpin() : 0);
+	}
 }
 
 // Run Haptic Effect
@@ -1375,6 +1915,13 @@ bool Wheel::runEffect(unsigned int effect, Uint32 iterations)
 	// Sanity Checks
 	if (!checkHaptic() || !checkIterations(iterations) || !checkEffectNumber(effect)) return false;
 
+	// Already playing for ever - running it again changes nothing
+	if (((activeEffects >> effect) & 1) && effectsMap[effect] != EFFECT_ERROR && shadows[effect].ends == 0)
+	{
+		effectStats.runsElided++;
+		return true;
+	}
+
 	log("RunEffect Number: " + std::to_string(effect) + " (" + effectsName[effect] + ")");
 
 	if (effectsMap[effect] == EFFECT_ERROR)
@@ -1383,8 +1930,14 @@ bool Wheel::runEffect(unsigned int effect, Uint32 iterations)
 		return false;
 	}
 
-	int r = SDL_HapticRunEffect(haptic, effectsMap[effect], iterations);
+	effectStats.runs++;
+	int r = deviceRun(effect, effectsMap[effect], iterations);
 	if (r < 0) log("Error: " + std::string(SDL_GetError()));
+	else
+	{
+		shadows[effect].ends = effectEnd(shadows[effect].params, now(), iterations);
+		activeEffects |= 1u << effect;
+	}
 	return (r == 0 ? true : false);
 }
 
@@ -1409,10 +1962,10 @@ Sint16 Wheel::findLeftLock()
 
 	// Should get to end within 3 seconds
 	wait(4500);
-	clock_t now = clock();
+	Uint64 start = now();
 
-	// take samples for 1 second ish
-	while ((clock() - now) < 1000)
+	// take samples for 1 second
+	while (now() - start < 1000 * NS_PER_MS && !cancelled())
 	{
 		Sint16 pos = getPosition();
 		if (pos == 0)
@@ -1451,10 +2004,10 @@ Sint16 Wheel::findRightLock()
 
 	// Should get to end within 3 seconds
 	wait(4500);
-	clock_t now = clock();
+	Uint64 start = now();
 
-	// take samples for 1 second ish
-	while ((clock() - now) < 1000)
+	// take samples for 1 second
+	while (now() - start < 1000 * NS_PER_MS && !cancelled())
 	{
 		Sint16 pos = getPosition();
 		if (pos == 0)
@@ -1476,65 +2029,359 @@ Sint16 Wheel::findRightLock()
 // TODO return false if failed. What constitutes a failure here?
 bool Wheel::calibrate()
 {
+	ProgressScope scope(*this);
 	bool ok = true;
 
+	// Put back if cancelled part way
+	Sint16 oldLeft = leftLock, oldRight = rightLock, oldCentre = centre;
+
 	// Get near centre
 	Uint16 level = L20;
 
 	if (isEffectRunning(DAMPER) || isEffectRunning(INERTIA) || isEffectRunning(FRICTION) || isEffectRunning(SPRING)) level = L32;
 
 	gotoAngle(0, level);
+	reportProgress(0.05f);
 
 	// find left lock
 	leftLock = findLeftLock();
+	reportProgress(0.3f);
 
 	gotoAngle(0, level);
 	waitNoLog(1000);
 
 	// find right lock
 	rightLock = findRightLock();
+	reportProgress(0.6f);
+
+	if (cancelled())
+	{
+		leftLock = oldLeft;
+		rightLock = oldRight;
+		log("Calibration cancelled");
+		return false;
+	}
+
+	countsPerDegree = (float)(std::abs(leftLock) + std::abs(rightLock)) / DEGREES;
 
 	// find centre
 	centre = ((leftLock + rightLock) / 2) + OFFSET;
 	log("Centre point: " + std::to_string(centre));
 
-	waitNoLog(1000);
-
-	// get jitter
-	findJitter();
-
+	// Jitter is measured by the sampler whenever the wheel is idle
 	gotoAngle(0, level);
 
+	if (cancelled())
+	{
+		leftLock = oldLeft;
+		rightLock = oldRight;
+		centre = oldCentre;
+		countsPerDegree = (float)(std::abs(leftLock) + std::abs(rightLock)) / DEGREES;
+		log("Calibration cancelled");
+		return false;
+	}
+
 	return true;
 }
 
 
+// Speeds are the profiled velocities of the old fixed levels
 bool Wheel::gotoAngleSlow(Sint16 angle)
 {
-	return gotoAngle(angle, SLOW);
+	return moveTo(angle, levelVelocity(SLOW, angle > getAngle() ? RIGHT : LEFT));
 }
 
 bool Wheel::gotoAngleFast(Sint16 angle)
 {
-	return gotoAngle(angle, FAST);
+	return moveTo(angle, levelVelocity(FAST, angle > getAngle() ? RIGHT : LEFT));
 }
 
 bool Wheel::gotoAngleFullSpeed(Sint16 angle)
 {
-	return gotoAngle(angle, FULL);
+	return moveTo(angle, levelVelocity(FULL, angle > getAngle() ? RIGHT : LEFT));
+}
+
+// Plan a time optimal move and follow it. Slowing down is done by the
+// same force pushing the other way.
+bool Wheel::moveTo(float angle, float maxVelocity, float maxAcceleration, float jerk)
+{
+	ProgressScope scope(*this);
+	if (!checkHaptic()) return false;
+	if (std::abs(angle) > DEGREES / 2)
+	{
+		log("Error: Bad angle");
+		return false;
+	}
+
+	float cpd = countsPerDegree;
+	float from = (getPosition() + OFFSET) / cpd;
+	if (maxVelocity <= 0.0f) maxVelocity = levelVelocity(FULL, angle > from ? RIGHT : LEFT);
+
+	Trajectory path;
+	if (!path.plan(from, angle, { maxVelocity, maxAcceleration, jerk }))
+	{
+		log("Error: Cant plan move with velocity: " + std::to_string(maxVelocity) + " acceleration: " + std::to_string(maxAcceleration));
+		return false;
+	}
+	log("Moving to angle: " + std::to_string(angle) + " in " + std::to_string(path.duration() * 1000.0f) + " mS peak " + std::to_string(path.getPeakVelocity()) + " deg/S");
+
+	Uint64 start = now();
+	bool ok = trackReference([&path](float t) { return path.at(t); }, path.duration(), angle, nullptr);
+
+	float reached = (getPosition() + OFFSET) / cpd;
+	log("Wanted: " + std::to_string(angle) + " Got to angle: " + std::to_string(reached) + " in " + std::to_string((now() - start) / NS_PER_MS) + " mS");
+	return ok && std::abs(angle - reached) <= PLAN_TOLERANCE;
+}
+
+// Plan a path through the waypoints and follow it, keeping the
+// tracking error as it goes. Only the last waypoint is stopped at.
+bool Wheel::followPath(const std::vector<Waypoint>& waypoints, float maxVelocity, float maxAcceleration)
+{
+	ProgressScope scope(*this);
+	if (!checkHaptic()) return false;
+	if (waypoints.empty())
+	{
+		log("Error: No waypoints");
+		return false;
+	}
+	for (const Waypoint& point : waypoints)
+	{
+		if (std::abs(point.position) > DEGREES / 2)
+		{
+			log("Error: Bad angle");
+			return false;
+		}
+	}
+
+	float cpd = countsPerDegree;
+	float from = (getPosition() + OFFSET) / cpd;
+	if (maxVelocity <= 0.0f) maxVelocity = std::min(levelVelocity(FULL, LEFT), levelVelocity(FULL, RIGHT));
+
+	Path path;
+	if (!path.plan(from, waypoints, { maxVelocity, maxAcceleration, 0.0f }))
+	{
+		log("Error: Cant plan path with velocity: " + std::to_string(maxVelocity) + " acceleration: " + std::to_string(maxAcceleration));
+		return false;
+	}
+	float target = waypoints.back().position;
+	log("Following path of " + std::to_string(waypoints.size()) + " waypoints to angle: " + std::to_string(target) + " in " + std::to_string(path.duration() * 1000.0f) + " mS");
+
+	{
+		std::lock_guard<std::mutex> guard(pathLock);
+		pathStats = PathStats();
+		pathStats.planned = path.duration();
+		pathStats.running = true;
+	}
+
+	// Waypoint errors are taken on the first cycle at or after each arrival
+	size_t waypoint = 0;
+	double sum = 0.0, sumSquares = 0.0;
+	auto tracked = [&](float t, float error)
+	{
+		std::lock_guard<std::mutex> guard(pathLock);
+		float size = std::abs(error);
+		pathStats.cycles++;
+		sum += size;
+		sumSquares += (double)error * error;
+		pathStats.meanError = (float)(sum / pathStats.cycles);
+		pathStats.rmsError = (float)std::sqrt(sumSquares / pathStats.cycles);
+		pathStats.maxError = std::max(pathStats.maxError, size);
+		pathStats.lastError = error;
+		while (waypoint < path.size() && t >= path.arrival(waypoint))
+		{
+			pathStats.waypointErrors.push_back(error);
+			if (size > PATH_TOLERANCE) pathStats.missed++;
+			waypoint++;
+		}
+	};
+
+	Uint64 start = now();
+	bool ok = trackReference([&path](float t) { return path.at(t); }, path.duration(), target, tracked);
+
+	float reached = (getPosition() + OFFSET) / cpd;
+	PathStats stats;
+	{
+		std::lock_guard<std::mutex> guard(pathLock);
+		pathStats.taken = (now() - start) / 1.0e9f;
+		pathStats.finalError = target - reached;
+		pathStats.running = false;
+		stats = pathStats;
+	}
+
+	log("Path done in " + std::to_string((now() - start) / NS_PER_MS) + " mS error mean: " + std::to_string(stats.meanError) + " rms: " + std::to_string(stats.rmsError)
+		+ " max: " + std::to_string(stats.maxError) + " final: " + std::to_string(stats.finalError) + " missed: " + std::to_string(stats.missed));
+	return ok && stats.waypointErrors.size() == waypoints.size() && std::abs(stats.finalError) <= PLAN_TOLERANCE;
+}
+
+PathStats Wheel::getPathStats()
+{
+	std::lock_guard<std::mutex> guard(pathLock);
+	return pathStats;
+}
+
+// Drive the wheel along a reference - position, velocity and acceleration
+// t seconds from the start. The profile tables give the level that holds
+// each velocity, so most of the force is known before the wheel moves -
+// position and velocity error only trim it. Ends once the reference has
+// finished and the wheel has settled on target, or PLAN_SETTLE_TIME later.
+bool Wheel::trackReference(const std::function<MotionPoint(float)>& reference, float duration, float target, const std::function<void(float t, float error)>& tracked)
+{
+	float cpd = countsPerDegree;
+
+	stopEffect(DAMPER);
+	stopEffect(FRICTION);
+	stopEffect(INERTIA);
+	stopEffect(SPRING);
+
+	Uint64 start = now();
+	Uint64 next = start;
+	Uint64 end = start + (Uint64)(duration * 1.0e9f) + PLAN_SETTLE_TIME * NS_PER_MS;
+	bool ok = true;
+
+	while (ok && !cancelled())
+	{
+		Uint64 woke = now();
+		float t = (woke - start) / 1.0e9f;
+		reportProgress(t / duration);
+		float actual = (getPosition() + OFFSET) / cpd;
+		float speed = getVelocity() / cpd;
+		MotionPoint want = reference(t);
+		float error = want.position - actual;
+		if (tracked) tracked(t, error);
+
+		// Finished and settled, or out of time
+		if (t >= duration && std::abs(target - actual) <= PLAN_TOLERANCE && std::abs(speed) <= PLAN_SETTLED_VELOCITY) break;
+		if (now() >= end) break;
+
+		float lead = reference(t + FEEDFORWARD_LEAD).velocity;
+		float level = feedForwardLevel(lead * cpd) + PLAN_POSITION_GAIN * error + PLAN_VELOCITY_GAIN * (want.velocity - speed);
+		if (level > MAX) level = MAX;
+		if (level < -MAX) level = -MAX;
+		ok = driveTrajectory((int)level);
+		cycles[LOOP_CONTROL].record(next, woke, now());
+
+		next += PLAN_PERIOD * 1000ull;
+		waitUntil(next, PLAN_SPIN);
+	}
+
+	stopEffect(TRAJECTORY_FORCE);
+	return ok;
+}
+
+// Velocity in deg/S the profile measured for a constant level
+float Wheel::levelVelocity(Uint16 level, int dir)
+{
+	int lvl = level / 1000;
+	if (lvl > 32) lvl = 32;
+	int count = dir == LEFT ? effectLevelsLeft[lvl] : effectLevelsRight[lvl];
+	return count * 100.0f / countsPerDegree;
+}
+
+// Level that holds velocity (counts/S, +ve right) - interpolated from
+// the profile tables. Dips in the table are ignored so the map only rises.
+int Wheel::feedForwardLevel(float velocity)
+{
+	if (velocity == 0.0f) return 0;
+
+	int* table = velocity > 0 ? effectLevelsRight : effectLevelsLeft;
+	float count = std::abs(velocity) / 100.0f; // per 10mS as profiled
+	float below = 0.0f;
+	int belowLevel = 0;
+	int level = MAX;
+
+	for (int lvl = 1; lvl < 33; ++lvl)
+	{
+		float above = (float)table[lvl];
+		if (above <= below)
+		{
+			// Not moving yet - the breakaway level is the last of these
+			if (below == 0.0f) belowLevel = lvl;
+			continue;
+		}
+		if (above >= count)
+		{
+			level = (int)((belowLevel + (lvl - belowLevel) * (count - below) / (above - below)) * 1000.0f);
+			break;
+		}
+		below = above;
+		belowLevel = lvl;
+	}
+
+	return velocity > 0 ? level : -level;
+}
+
+// Set the trajectory force - +ve level turns right
+bool Wheel::driveTrajectory(int level)
+{
+	level = (int)(level * FORCE_SCALE);
+	int id = effectsMap[TRAJECTORY_FORCE];
+	if (id == EFFECT_ERROR)
+	{
+		trajectoryForce.type = SDL_HAPTIC_CONSTANT;
+		trajectoryForce.constant.direction.type = DIRECTION_TYPE;
+		trajectoryForce.constant.direction.dir[0] = -1;
+		trajectoryForce.constant.length = FOREVER;
+		trajectoryForce.constant.level = (Sint16)level;
+
+		id = deviceNewWithRoom(TRAJECTORY_FORCE, &trajectoryForce);
+		if (id < 0)
+		{
+			log("Error: (driveTrajectory) " + std::string(SDL_GetError()));
+			return false;
+		}
+		effectsMap[TRAJECTORY_FORCE] = id;
+	}
+	else if (trajectoryForce.constant.level != level)
+	{
+		trajectoryForce.constant.level = (Sint16)level;
+		if (deviceUpdate(TRAJECTORY_FORCE, id, &trajectoryForce) != 0) return false;
+	}
+
+	// Stopped at the end of the last move
+	if (!((activeEffects >> TRAJECTORY_FORCE) & 1))
+	{
+		if (deviceRun(TRAJECTORY_FORCE, id, 1) != 0)
+		{
+			log("Error: (driveTrajectory) " + std::string(SDL_GetError()));
+			return false;
+		}
+		activeEffects |= 1u << TRAJECTORY_FORCE;
+	}
+	return true;
 }
 
+// Done once getAngle() reads angle, as when angles were whole degrees -
+// it truncates, so the degree above a +ve angle, below a -ve one and
+// either side of 0
 bool Wheel::gotoAngle(Sint16 angle, Uint16 level)
 {
+	Sint32 angleMd = angle * MDEG_PER_DEGREE;
+	Sint32 low = angle > 0 ? angleMd : angleMd - (MDEG_PER_DEGREE - 1);
+	Sint32 high = angle < 0 ? angleMd : angleMd + (MDEG_PER_DEGREE - 1);
+	return gotoAngleWithin(angleMd, level, low, high);
+}
+
+// Within toleranceMd of angleMd
+bool Wheel::gotoAngleMd(Sint32 angleMd, Uint16 level, Sint32 toleranceMd)
+{
+	return gotoAngleWithin(angleMd, level, angleMd - toleranceMd, angleMd + toleranceMd);
+}
+
+// Drive towards angleMd - done if it stops between lowMd and highMd
+bool Wheel::gotoAngleWithin(Sint32 angleMd, Uint16 level, Sint32 lowMd, Sint32 highMd)
+{
+	ProgressScope scope(*this);
+	float angle = angleMd / (float)MDEG_PER_DEGREE;
 	log("Going to angle: " + std::to_string(angle));
 
 	// Sanity checks
-	if (getAngle() == angle)
+	Sint32 start = getAngleMd();
+	if (start >= lowMd && start <= highMd)
 	{
-		log("Wanted: " + std::to_string(angle) + " Got to angle: " + std::to_string(getAngle()));
+		log("Wanted: " + std::to_string(angle) + " Got to angle: " + std::to_string(getAngleMd() / (float)MDEG_PER_DEGREE));
 		return true;
 	}
-	if (std::abs(angle) > DEGREES / 2)
+	if (std::abs(angleMd) > DEGREES / 2 * MDEG_PER_DEGREE)
 	{
 		log("Error: Bad angle");
 		return false;
@@ -1546,15 +2393,15 @@ bool Wheel::gotoAngle(Sint16 angle, Uint16 level)
 	stopEffect(SPRING);
 	setDamper(FOREVER, 0, FULL, FULL, FULL, FULL);
 
-	int near = 10;
-	if (level < 10000) near = 5;
-	if (level > 15000) near = 15;
+	Sint32 near = 10 * MDEG_PER_DEGREE;
+	if (level < 10000) near = 5 * MDEG_PER_DEGREE;
+	if (level > 15000) near = 15 * MDEG_PER_DEGREE;
 
 
 	// Start moving in correct direction
 	int direction = LEFT;
 	setLeft(FOREVER, level);
-	if (angle > getAngle())
+	if (angleMd > getAngleMd())
 	{
 		direction = RIGHT;
 		setRight(FOREVER, level);
@@ -1567,43 +2414,48 @@ bool Wheel::gotoAngle(Sint16 angle, Uint16 level)
 
 	// Are we there yet?
 	bool there = false;
-	int now = 0;
-	while (!there)
+	Sint32 from = getAngleMd();
+	Sint32 currentMd = 0;
+	while (!there && !cancelled())
 	{
-		now = getAngle();
+		currentMd = getAngleMd();
+		if (from != angleMd) reportProgress((float)(currentMd - from) / (angleMd - from));
 		if (direction == LEFT)
 		{
-			if (now <= angle + near && !isEffectRunning(DAMPER)) runEffect(DAMPER);
-			if (now <= angle) there = true;
+			if (currentMd <= angleMd + near && !isEffectRunning(DAMPER)) runEffect(DAMPER);
+			if (currentMd <= angleMd) there = true;
 		}
 		else
 		{
-			if (now >= angle - near && !isEffectRunning(DAMPER)) runEffect(DAMPER);
-			if (now >= angle) there = true;
+			if (currentMd >= angleMd - near && !isEffectRunning(DAMPER)) runEffect(DAMPER);
+			if (currentMd >= angleMd) there = true;
 		}
 		//waitNoLog(10);
 	}
 	if (direction == LEFT) stopEffect(LEFT); else stopEffect(RIGHT);
-	waitNoLog(200);
+	waitSettled(200);
 	stopEffect(DAMPER);
 
-	log("Wanted: " + std::to_string(angle) + " Got to angle: " + std::to_string(getAngle()));
-	if (angle != getAngle()) return false;
-	return true;
+	Sint32 reached = getAngleMd();
+	log("Wanted: " + std::to_string(angle) + " Got to angle: " + std::to_string(reached / (float)MDEG_PER_DEGREE));
+	return reached >= lowMd && reached <= highMd;
 }
 
 Sint16 Wheel::findJitter()
 {
+	ProgressScope scope(*this);
 	log("Finding jitter...");
 	int min, max;
 	int max_jitter = 0;
 	int j;
 
-	srand((unsigned int)time(0));
+	srand(randomSeed);
 
 	// Get 10 random angles
 	for (int k = 0; k < 10; ++k)
 	{
+		reportProgress(k / 10.0f);
+
 		// random angle
 		int rn = (rand() % ((DEGREES - 2) / 4) + 1);
 		int rd = (rand() % 2) + 1;
@@ -1620,7 +2472,7 @@ Sint16 Wheel::findJitter()
 		j = 0;
 
 		// get 100 readings
-		for (int i = 0; i < 100; ++i)
+		for (int i = 0; i < 100 && !cancelled(); ++i)
 		{
 			int pos = std::abs(getPosition());
 			if (pos < min) min = pos;
@@ -1628,6 +2480,12 @@ Sint16 Wheel::findJitter()
 			waitNoLog(10);
 		}
 
+		if (cancelled())
+		{
+			log("Jitter cancelled");
+			return jitter;
+		}
+
 		// Max so far
 		j = max - min;
 		if (j > max_jitter) max_jitter = j;
@@ -1643,10 +2501,13 @@ Sint16 Wheel::findJitter()
 	return jitter;
 }
 
+// Worst idle noise measured so far, or findJitter()'s figure before any
 Sint16 Wheel::getJitter()
 {
-	log("Jitter: " + std::to_string(jitter));
-	return jitter;
+	NoiseEstimate e = noise.worst();
+	Sint16 j = e.valid ? e.peakToPeak : jitter;
+	log("Jitter: " + std::to_string(j) + (e.valid ? " (" + std::to_string(e.windows) + " idle windows)" : ""));
+	return j;
 }
 
 Sint16 Wheel::getLeftLock()
@@ -1667,29 +2528,12 @@ Sint16 Wheel::getCentre()
 	return centre;
 }
 
-// Get distance travelled in time mS
+// Get distance travelled in time mS at the estimated velocity
 Sint16 Wheel::getDistance(Uint32 time)
 {
-	using namespace std::chrono;
-	int pos2;
-	int pos1 = getPosition();
-	duration<double, std::milli> timeSpan;
-	high_resolution_clock::time_point startPoint = high_resolution_clock::now();
-
-	bool done = false;
-	while (!done)
-	{
-		high_resolution_clock::time_point endPoint = high_resolution_clock::now();
-		timeSpan = endPoint - startPoint;
-		if (timeSpan.count() >= time)
-		{
-			pos2 = getPosition();
-			done = true;
-		}
-	}
-
-	Sint16 dist = pos2 - pos1;
-	log("Distance travelled in: " + std::to_string(timeSpan.count()) + " mS was " + std::to_string(dist) + " units");
+	WheelEstimate e = getEstimate();
+	Sint16 dist = (Sint16)(e.velocity * time / 1000.0f);
+	log("Distance travelled in: " + std::to_string(time) + " mS is " + std::to_string(dist) + " units (+/- " + std::to_string((int)(e.velocitySd * time / 1000.0f)) + ")");
 
 	return dist;
 }
@@ -1697,96 +2541,110 @@ Sint16 Wheel::getDistance(Uint32 time)
 // Is the wheel stationary?
 bool Wheel::isStationary()
 {
+	return settle.isSettled();
+}
+
+void Wheel::setSettleBand(Uint16 band, Uint32 holdMs)
+{
+	settle.configure(band, holdMs);
+	log("Settle band: " + (band == SETTLE_AUTO_BAND ? std::string("auto") : std::to_string(band)) + " count for " + std::to_string(holdMs) + " mS");
+}
 
-	for (int i = 0; i <= STATIONARY_TESTS; ++i)
+// Returns the moment the sampler sees the wheel settle
+bool Wheel::waitSettled(Uint32 timeoutMs)
+{
+	Uint64 end = now() + timeoutMs * NS_PER_MS;
+	while (!settle.isSettled())
 	{
-		int p1 = getPosition();
-		wait(10);
-		int p2 = getPosition();
-		if (!(std::abs(p2 - p1) < std::abs(jitter + JITTER_MARGIN))) return false;
+		if (now() >= end || cancelled()) return false;
+		if (replaying != nullptr) advance(samplePeriod * NS_PER_US);
+		else settle.waitFor(std::min((Uint32)((end - now()) / NS_PER_MS) + 1, MOTION_POLL));
 	}
-
-	log("Wheel is stationary within: " + std::to_string(jitter + JITTER_MARGIN) + " count");
-
 	return true;
+}
 
+void Wheel::onSettled(SettleCallback callback)
+{
+	settle.onSettled(callback);
 }
 
 // Convert level into force value taking scaling into account
 double Wheel::convertLevelToForce(Uint16 lvl)
 {
-	double max = getMaxGain();
-	if (max == EFFECT_ERROR) max = 100.0;
-
-	double gain = getGain();
-	if (gain == EFFECT_ERROR) gain = 100.0;
-
-	if (gain == 0 || max == 0)
+	if (levelToForce == 0.0)
 	{
 		log("Error: Force is: 0.0 Nm");
 		return 0.0f;
 	}
-
-	double level = lvl * (max / 100.0) * (gain / 100.0);
-	double ratio = level / MAX;
-	log("Level: " + std::to_string(lvl) + " converts to force: " + std::to_string(ratio * RATED_HAPTIC_FORCE) + " Nm");
-	return (double)(ratio * RATED_HAPTIC_FORCE);
+	return lvl * levelToForce;
 }
 
 // Convert force into level taking scaling into account
 Uint16 Wheel::convertForceToLevel(float force)
 {
-	if (RATED_HAPTIC_FORCE <= 0)
-	{
-		log("Error: RATED_HAPTIC_FORCE is too small. Zero force returned.");
-		return 0;
-	}
-
-	double ratio = force / RATED_HAPTIC_FORCE;
-	if (ratio > 1)
+	if (force > RATED_HAPTIC_FORCE)
 	{
 		log("Error: Force supplied is greater than wheel's haptic ability. MAX force will be used.");
 		return MAX;
 	}
 
-	double level = MAX * ratio;
-
-	// apply scaling
-	double max = getMaxGain();
-	if (max == EFFECT_ERROR) max = 100.0;
-
-	double gain = getGain();
-	if (gain == EFFECT_ERROR) gain = 100.0;
-
-	if (gain == 0 || max == 0)
+	if (forceToLevel == 0.0)
 	{
 		log("Error: Level is 0 due to gain and maxGain settings");
 		return 0;
 	}
 
-	level = level * (1 / (gain / 100)) * (1 / (max / 100));
+	double level = force * forceToLevel;
 	if (level > MAX)
 	{
-		level = MAX;
 		log("Error: After scaling level: " + std::to_string(level) + " was bigger than MAX. Setting to MAX");
+		return MAX;
 	}
 	if (level <= 0)
 	{
-		level = 0;
 		log("Error: After scaling level was smaller than 0. Setting to 0");
+		return 0;
 	}
-
-	log("Force: " + std::to_string(force) + " Nm converts to level: " + std::to_string((Uint16)level));
 	return (Uint16)level;
 }
 
+size_t Wheel::convertLevelsToForces(const Uint16* levels, float* forces, size_t count)
+{
+	float k = (float)levelToForce;
+	for (size_t i = 0; i < count; ++i) forces[i] = levels[i] * k;
+	return 0;
+}
+
+size_t Wheel::convertForcesToLevels(const float* forces, Uint16* levels, size_t count)
+{
+	float k = (float)forceToLevel;
+	size_t clamped = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		float level = forces[i] * k;
+		if (level > MAX) { level = MAX; ++clamped; }
+		else if (level < 0) { level = 0; ++clamped; }
+		levels[i] = (Uint16)level;
+	}
+	return clamped;
+}
+
 // Profile effect levels
 void Wheel::profile()
 {
+	ProgressScope scope(*this);
 	log("Profiling effect levels...");
 
-	profileD(RIGHT);
-	profileD(LEFT);
+	// Measured into copies so a cancelled profile leaves the tables as they were
+	int right[33], left[33];
+	if (!profileD(RIGHT, right) || !profileD(LEFT, left))
+	{
+		log("Profile cancelled");
+		return;
+	}
+	std::copy(right, right + 33, effectLevelsRight);
+	std::copy(left, left + 33, effectLevelsLeft);
+	cacheTopSpeed();
 
 	// Show results
 	for (int lvl = 0; lvl < 33; ++lvl)
@@ -1797,12 +2655,15 @@ void Wheel::profile()
 	gotoAngle(0);
 }
 
-// get effect level profile of dir
-void Wheel::profileD(int dir)
+// get effect level profile of dir - false if cancelled part way
+bool Wheel::profileD(int dir, int* table)
 {
 	// Loop thru all effect levels
-	for (int lvl = 0; lvl < 33; ++lvl)
+	for (int lvl = 0; lvl < 33 && !cancelled(); ++lvl)
 	{
+		// Right is profiled first
+		reportProgress((dir == LEFT ? 0.5f : 0.0f) + lvl / 66.0f);
+
 		// Reset position
 		gotoAngle(0);
 
@@ -1814,13 +2675,23 @@ void Wheel::profileD(int dir)
 		// Wait for force to build up momentum
 		wait(150);
 
-		// Take 20 readings of how far travelled in 10 mS
+		// Average the estimated 10 mS move - the estimate is already filtered
 		int average = 0;
-		for (int i = 0; i < 20; ++i) average += std::abs(getDistance(10));
+		for (int i = 0; i < PROFILE_READINGS; ++i)
+		{
+			waitNoLog(PROFILE_INTERVAL);
+			average += std::abs(getDistance(10));
+		}
+
+		if (cancelled())
+		{
+			stopEffect(dir == LEFT ? LEFT : RIGHT);
+			return false;
+		}
 
 		// Store result
-		int result = average / 20;
-		if (dir == LEFT) effectLevelsLeft[lvl] = result; else effectLevelsRight[lvl] = result;
+		int result = average / PROFILE_READINGS;
+		table[lvl] = result;
 		log("Profile level 10mS move count: " + std::to_string(lvl) + " = " + std::to_string(result));
 
 		stopEffect(dir == LEFT ? LEFT : RIGHT);
@@ -1833,8 +2704,9 @@ void Wheel::profileD(int dir)
 			stopEffect(dir == LEFT ? RIGHT : LEFT);
 		}
 
-		while (!isStationary()) wait(50);
+		if (!waitSettled(PROFILE_SETTLE_TIMEOUT)) log("Error: Wheel did not settle");
 	}
+	return !cancelled();
 }
 
 // Get the distance travelled over 10mS and find the nearest level that would achieve the same
@@ -1851,4 +2723,1335 @@ Uint16 Wheel::getClosestEffectLevel(int distance, int dir)
 	log("Closes effect level for distance: " + std::to_string(distance) + " is " + std::to_string(l));
 
 	return l * 1000;
-}
\ No newline at end of file
+}
+// Find the fastest each command keeps up at for each effect type. Levels
+// are all zero so nothing moves.
+bool Wheel::characteriseRates(std::vector<RateResult>& results, bool apply)
+{
+	if (!checkHaptic()) return false;
+	if (replaying != nullptr)
+	{
+		log("Error: Command rates can only be measured on a device");
+		return false;
+	}
+
+	static const EffectDescriptor trials[] = {
+		constantEffect(RIGHT, FOREVER, 0),
+		periodicEffect(SINE, FOREVER, 100, 0, LEFT),
+		conditionEffect(DAMPER, FOREVER, 0, 0, 0, 0, 0),
+		rampEffect(RAMP_RIGHT, 1000, 0, 0)
+	};
+	static const char* effects[] = { "constant", "periodic", "condition", "ramp" };
+	static const char* commands[] = { "new", "update", "run" };
+
+	log("Characterising command rates...");
+	Uint32 enforced = commandRate.getRate();
+	commandRate.setRate(RATE_UNLIMITED);
+
+	results.clear();
+	Uint32 slowest = SDL_MAX_UINT32;
+	for (int t = 0; t < 4 && !cancelled(); ++t)
+	{
+		SDL_HapticEffect effect;
+		trials[t].fill(effect);
+		for (int c = 0; c < 3 && !cancelled(); ++c)
+		{
+			RateResult result;
+			result.command = commands[c];
+			result.effect = effects[t];
+			for (Uint32 rate : RATE_STEPS)
+			{
+				if (cancelled()) break;
+				RatePoint point = rateRun(c, effect, rate);
+				result.points.push_back(point);
+				log("Rate " + std::string(commands[c]) + " " + effects[t] + " " + std::to_string(rate) + " Hz: achieved " + std::to_string((int)point.achieved)
+					+ " latency mean " + std::to_string((int)point.meanLatency) + " p95 " + std::to_string((int)point.p95Latency) + " max " + std::to_string((int)point.maxLatency)
+					+ " uS growth " + std::to_string(point.growth) + (point.sustained ? " ok" : " too fast"));
+
+				// Already falling behind - faster only adds lag
+				if (!point.sustained) break;
+				result.sustained = rate;
+			}
+			slowest = std::min(slowest, result.sustained);
+			results.push_back(result);
+		}
+	}
+
+	commandRate.setRate(enforced);
+	if (cancelled()) return false;
+
+	log("Slowest sustained command rate: " + std::to_string(slowest) + " Hz");
+	if (apply && slowest > 0) setCommandRate((Uint32)(slowest * RATE_MARGIN));
+	return slowest > 0;
+}
+
+// One trial - command 0 new (then destroyed, not timed), 1 update, 2 run
+RatePoint Wheel::rateRun(int command, const SDL_HapticEffect& effect, Uint32 rate)
+{
+	SDL_HapticEffect e = effect;
+	int id = EFFECT_ERROR;
+	if (command != 0)
+	{
+		id = deviceNew(RATE_TYPE, &e);
+		if (id < 0)
+		{
+			log("Error: (characteriseRates) " + std::string(SDL_GetError()));
+			return RatePoint();
+		}
+	}
+
+	std::vector<Uint64> latencies;
+	latencies.reserve(rate * RATE_TRIAL / 1000 + 1);
+	Uint32 failures = 0;
+	Uint64 period = 1000000000ull / rate;
+	Uint64 start = clockNow();
+	Uint64 end = start + RATE_TRIAL * NS_PER_MS;
+	Uint64 next = start;
+	while (next < end)
+	{
+		sleepUntil(next, REALTIME_SPIN);
+		Uint64 sent = clockNow();
+		int result = 0;
+		if (command == 0) result = deviceNew(RATE_TYPE, &e);
+		else if (command == 1)
+		{
+			// Every effect type has delay in the same place - changed so no update is the same
+			e.constant.delay ^= 1;
+			result = deviceUpdate(RATE_TYPE, id, &e);
+		}
+		else result = deviceRun(RATE_TYPE, id, 1);
+		Uint64 done = clockNow();
+
+		latencies.push_back(done - sent);
+		if (result < 0) failures++;
+		if (command == 0 && result >= 0) deviceDestroy(RATE_TYPE, result);
+
+		// Behind - carry on flat out, the rate achieved shows it
+		next += period;
+		if (next < done) next = done;
+	}
+	RatePoint point = rateTrial(rate, clockNow() - start, latencies, failures);
+
+	if (id != EFFECT_ERROR)
+	{
+		deviceStop(RATE_TYPE, id);
+		deviceDestroy(RATE_TYPE, id);
+	}
+	return point;
+}
+
+void Wheel::setCommandRate(Uint32 hz)
+{
+	commandRate.setRate(hz);
+	log(hz == RATE_UNLIMITED ? std::string("Command rate unlimited") : "Command rate limited to " + std::to_string(hz) + " Hz");
+}
+
+Uint32 Wheel::getCommandRate()
+{
+	return commandRate.getRate();
+}
+
+CommandRateStats Wheel::getCommandRateStats()
+{
+	return commandRate.getStats();
+}
+
+// Upload the streamed force and leave it playing at nothing
+bool Wheel::startForceStream()
+{
+	if (!checkHaptic()) return false;
+	if (streamId != EFFECT_ERROR) return true;
+
+	streamForce.type = SDL_HAPTIC_CONSTANT;
+	streamForce.constant.direction.type = DIRECTION_TYPE;
+	streamForce.constant.direction.dir[0] = -1; // +ve level turns right
+	streamForce.constant.length = FOREVER;
+	streamForce.constant.level = 0;
+
+	int id = deviceNewWithRoom(STREAM_TYPE, &streamForce);
+	if (id < 0 || deviceRun(STREAM_TYPE, id, 1) != 0)
+	{
+		log("Error: (startForceStream) " + std::string(SDL_GetError()));
+		if (id >= 0) deviceDestroy(STREAM_TYPE, id);
+		return false;
+	}
+
+	forceMailbox.reset();
+	streamHolding = false;
+	streamId = id;
+	log("Force stream started");
+	return true;
+}
+
+void Wheel::postForce(Sint16 level)
+{
+	forceMailbox.post(level, now());
+}
+
+void Wheel::stopForceStream()
+{
+	if (retireSamplerEffect(streamId, STREAM_TYPE)) log("Force stream stopped");
+}
+
+MailboxStats Wheel::getForceStreamStats()
+{
+	return forceMailbox.getStats();
+}
+
+// Sampler thread - send the newest posted force if the device has a slot
+void Wheel::pushStreamForce(int id)
+{
+	// A level the device refused, or that found the haptic lock busy, is
+	// held and sent again, unless a newer post replaces it - otherwise a
+	// last post of 0 could be lost and the old force kept for ever. Left
+	// in the mailbox until there is a slot.
+	if (!streamHolding && !forceMailbox.pending()) return;
+	if (!commandRate.tryReserve(clockNow())) return;
+
+	Sint16 level;
+	Uint64 posted;
+	if (forceMailbox.take(level, posted))
+	{
+		streamHeld = (Sint16)(level * FORCE_SCALE);
+		streamHeldAt = posted;
+		streamHolding = true;
+	}
+	if (streamHeld == streamForce.constant.level)
+	{
+		streamHolding = false;
+		return;
+	}
+
+	SDL_HapticEffect e = streamForce;
+	e.constant.level = streamHeld;
+	if (deviceUpdate(STREAM_TYPE, id, &e, true) != 0) return;
+	streamForce.constant.level = streamHeld;
+	streamHolding = false;
+	forceMailbox.sentAt(streamHeldAt, now());
+}
+
+// Walls at left and right angles - pushed back by the sampler as soon as
+// the wheel reaches one
+bool Wheel::setEndStops(float left, float right, float stiffness, float hysteresis, Uint16 maxLevel)
+{
+	if (!checkHaptic()) return false;
+	if (left >= right)
+	{
+		log("Error: End-stop left (" + std::to_string(left) + ") must be less than right (" + std::to_string(right) + ")");
+		return false;
+	}
+	if (stiffness <= 0.0f || hysteresis < 0.0f)
+	{
+		log("Error: End-stop stiffness must be > 0 and hysteresis >= 0");
+		return false;
+	}
+	if (maxLevel > MAX)
+	{
+		log("Error: End-stop level Out of Bounds");
+		return false;
+	}
+
+	// Uploaded and left playing at nothing - reaching a wall is one update
+	if (endStopId == EFFECT_ERROR)
+	{
+		endStopForce.type = SDL_HAPTIC_CONSTANT;
+		endStopForce.constant.direction.type = DIRECTION_TYPE;
+		endStopForce.constant.direction.dir[0] = -1; // +ve level turns right
+		endStopForce.constant.length = FOREVER;
+		endStopForce.constant.level = 0;
+
+		int id = deviceNewWithRoom(ENDSTOP_TYPE, &endStopForce);
+		if (id < 0 || deviceRun(ENDSTOP_TYPE, id, 1) != 0)
+		{
+			log("Error: (setEndStops) " + std::string(SDL_GetError()));
+			if (id >= 0) deviceDestroy(ENDSTOP_TYPE, id);
+			return false;
+		}
+		endStopId = id;
+	}
+
+	endStops.configure(left, right, stiffness, hysteresis, maxLevel);
+	log("End-stops at " + std::to_string(left) + " and " + std::to_string(right) + " degrees");
+	return true;
+}
+
+void Wheel::clearEndStops()
+{
+	endStops.disable();
+	if (retireSamplerEffect(endStopId, ENDSTOP_TYPE)) log("End-stops cleared");
+}
+
+// Take an effect from the sampler and destroy it. The sampler flags
+// each send, so one already under way with the old id finishes before
+// the id goes - SDL may hand it to the next effect uploaded.
+bool Wheel::retireSamplerEffect(std::atomic<int>& slot, unsigned int type)
+{
+	int id = slot.exchange(EFFECT_ERROR);
+	if (id == EFFECT_ERROR) return false;
+
+	while (samplerSending) std::this_thread::yield();
+	deviceStop(type, id);
+	deviceDestroy(type, id);
+	return true;
+}
+
+EndStopStats Wheel::getEndStopStats()
+{
+	return endStops.getStats();
+}
+
+// Sampler thread - send the wall force and time it from the sample
+void Wheel::pushEndStop(int level, Uint64 time)
+{
+	int id = endStopId;
+	if (id == EFFECT_ERROR) return;
+
+	// Never wait for a slot here - the next sample tries again
+	if (!commandRate.tryReserve(clockNow()))
+	{
+		commandRate.skip();
+		return;
+	}
+
+	endStopForce.constant.level = (Sint16)(level * FORCE_SCALE);
+	if (deviceUpdate(ENDSTOP_TYPE, id, &endStopForce, true) != 0) return; // tried again next sample
+	endStops.sent(level, (Uint32)((now() - time) / 1000));
+}
+
+// Drive the telemetry effects. Each is uploaded and started once then
+// updated in place, so nothing is allocated or logged per frame.
+bool Wheel::applyTelemetry(Sint16 level, Uint16 texture, Uint32 period)
+{
+	if (!hasHaptic) return false;
+
+	bool ok = true;
+	level = (Sint16)(level * FORCE_SCALE);
+	texture = scaleLevel(texture);
+	if (period == 0) texture = 0;
+
+	// Rack force - RIGHT direction so +ve level turns right
+	int id = effectsMap[TELEMETRY_FORCE];
+	if (id == EFFECT_ERROR)
+	{
+		telemetryForce.type = SDL_HAPTIC_CONSTANT;
+		telemetryForce.constant.direction.type = DIRECTION_TYPE;
+		telemetryForce.constant.direction.dir[0] = -1;
+		telemetryForce.constant.length = FOREVER;
+		telemetryForce.constant.level = level;
+
+		id = deviceNewWithRoom(TELEMETRY_FORCE, &telemetryForce);
+		if (id < 0 || deviceRun(TELEMETRY_FORCE, id, 1) != 0)
+		{
+			log("Error: (applyTelemetry) " + std::string(SDL_GetError()));
+			// Uploaded but not running - start again next frame
+			if (id >= 0) deviceDestroy(TELEMETRY_FORCE, id);
+			id = EFFECT_ERROR;
+			ok = false;
+		}
+		else activeEffects |= 1u << TELEMETRY_FORCE;
+		effectsMap[TELEMETRY_FORCE] = id;
+	}
+	else if (telemetryForce.constant.level != level)
+	{
+		// Kept only once sent, so a failed update is tried again next frame
+		SDL_HapticEffect update = telemetryForce;
+		update.constant.level = level;
+		if (deviceUpdate(TELEMETRY_FORCE, id, &update) == 0) telemetryForce = update;
+		else ok = false;
+	}
+
+	// Road texture - sine wave, DOWN as for setSine()
+	id = effectsMap[TELEMETRY_TEXTURE];
+	if (id == EFFECT_ERROR)
+	{
+		if (texture == 0) return ok;
+
+		telemetryTexture.type = SDL_HAPTIC_SINE;
+		telemetryTexture.periodic.direction.type = DIRECTION_TYPE;
+		telemetryTexture.periodic.direction.dir[1] = -1;
+		telemetryTexture.periodic.length = FOREVER;
+		telemetryTexture.periodic.period = period;
+		telemetryTexture.periodic.magnitude = texture;
+
+		id = deviceNewWithRoom(TELEMETRY_TEXTURE, &telemetryTexture);
+		if (id < 0 || deviceRun(TELEMETRY_TEXTURE, id, 1) != 0)
+		{
+			log("Error: (applyTelemetry) " + std::string(SDL_GetError()));
+			// Uploaded but not running - start again next frame
+			if (id >= 0) deviceDestroy(TELEMETRY_TEXTURE, id);
+			id = EFFECT_ERROR;
+			ok = false;
+		}
+		else activeEffects |= 1u << TELEMETRY_TEXTURE;
+		effectsMap[TELEMETRY_TEXTURE] = id;
+	}
+	else if (telemetryTexture.periodic.magnitude != (Sint16)texture || (texture != 0 && telemetryTexture.periodic.period != period))
+	{
+		SDL_HapticEffect update = telemetryTexture;
+		update.periodic.magnitude = texture;
+		if (texture != 0) update.periodic.period = period;
+		if (deviceUpdate(TELEMETRY_TEXTURE, id, &update) == 0) telemetryTexture = update;
+		else ok = false;
+	}
+
+	return ok;
+}
+
+// Queue an operation for the command thread
+MotionHandle Wheel::submit(const std::string& name, std::function<bool()> task, Uint32 timeout, MotionProgress progress)
+{
+	std::shared_ptr<MotionControl> control = std::make_shared<MotionControl>();
+	control->timeout = timeout;
+	control->onProgress = progress;
+
+	std::shared_ptr<std::promise<int>> done = std::make_shared<std::promise<int>>();
+	MotionHandle handle(control, done->get_future().share());
+
+	MotionTask entry;
+	entry.control = control;
+	entry.run = [this, name, task, control, done]()
+	{
+		int result = MOTION_CANCELLED;
+		if (!control->cancel)
+		{
+			log("Async start: " + name);
+			if (control->timeout > 0) control->deadline = now() + control->timeout * NS_PER_MS;
+			bool ok = task();
+
+			if (control->timedOut) result = MOTION_TIMEOUT;
+			else if (control->cancel) result = MOTION_CANCELLED;
+			else result = ok ? MOTION_OK : MOTION_FAILED;
+			log("Async end: " + name + " (" + std::to_string(result) + ")");
+		}
+		if (result == MOTION_OK) control->progress = 1.0f;
+		done->set_value(result);
+	};
+
+	{
+		std::lock_guard<std::mutex> lock(commandLock);
+		startCommander();
+		commands.push_back(entry);
+	}
+	commandReady.notify_one();
+	return handle;
+}
+
+// Queue a short command - the result comes back through the future
+std::future<int> Wheel::post(std::function<int()> command)
+{
+	std::shared_ptr<std::promise<int>> result = std::make_shared<std::promise<int>>();
+	std::future<int> future = result->get_future();
+	if (!post(command, [result](int r) { result->set_value(r); }))
+	{
+		result->set_value(EFFECT_ERROR);
+	}
+	return future;
+}
+
+// Queue a short command - done is called with the result on the command thread
+bool Wheel::post(std::function<int()> command, std::function<void(int result)> done)
+{
+	if (!command)
+	{
+		log("Error: post() needs a command");
+		return false;
+	}
+
+	if (!commanderStarted)
+	{
+		std::lock_guard<std::mutex> lock(commandLock);
+		startCommander();
+	}
+
+	if (!posted.push([command, done]()
+		{
+			int result = command();
+			if (done) done(result);
+		}))
+	{
+		log("Error: command queue full - " + std::to_string(posted.capacity()) + " waiting");
+		return false;
+	}
+
+	wakeCommander();
+	return true;
+}
+
+// Call with commandLock held
+void Wheel::startCommander()
+{
+	if (commander.joinable()) return;
+	commanding = true;
+	commander = std::thread(&Wheel::commandLoop, this);
+	commanderStarted = true;
+}
+
+// Only takes the lock when the command thread is asleep
+void Wheel::wakeCommander()
+{
+	// Pairs with the fence in commandLoop() - either it sees the push or we see it idle
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!commandIdle) return;
+
+	{
+		// Held by the command thread until it is waiting, so the notify can't be missed
+		std::lock_guard<std::mutex> lock(commandLock);
+	}
+	commandReady.notify_one();
+}
+
+// Command thread only - everything posted so far, in order
+void Wheel::runPosted()
+{
+	if (servicing) return;
+	servicing = true;
+
+	std::function<void()> command;
+	while (posted.pop(command))
+	{
+		command();
+	}
+	servicing = false;
+}
+
+// Runs queued operations in order until stopped
+void Wheel::commandLoop()
+{
+	commanderId = std::this_thread::get_id();
+	applyControlRealtime();
+
+	std::unique_lock<std::mutex> lock(commandLock);
+	while (true)
+	{
+		lock.unlock();
+		runPosted();
+		lock.lock();
+
+		if (commands.empty())
+		{
+			if (!commanding) break;
+
+			commandIdle = true;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (posted.empty()) commandReady.wait(lock);
+			commandIdle = false;
+			continue;
+		}
+
+		MotionTask task = commands.front();
+		commands.pop_front();
+		if (!commanding) task.control->cancel = true;
+
+		// Set under the lock so cancelMotion() never misses it
+		motion = task.control.get();
+		lock.unlock();
+		task.run();
+		lock.lock();
+		motion = nullptr;
+	}
+	commanderId = std::thread::id();
+}
+
+// Cancel everything then finish the thread - queued calls report cancelled,
+// posted commands still run
+void Wheel::stopCommands()
+{
+	if (!commander.joinable()) return;
+
+	{
+		std::lock_guard<std::mutex> lock(commandLock);
+		commanding = false;
+	}
+	cancelMotion();
+	commandReady.notify_one();
+	commander.join();
+
+	// Anything posted as it stopped
+	commanderStarted = false;
+	runPosted();
+}
+
+void Wheel::cancelMotion()
+{
+	std::lock_guard<std::mutex> lock(commandLock);
+	for (MotionTask& task : commands) task.control->cancel = true;
+	MotionControl* running = motion;
+	if (running != nullptr) running->cancel = true;
+}
+
+// Checked by the loops and waits of anything that can run async
+bool Wheel::cancelled()
+{
+	if (std::this_thread::get_id() != commanderId) return false;
+
+	// A posted command isn't part of the motion it runs inside - not cut short
+	if (servicing) return false;
+
+	// Motions check here often - posted commands don't wait for them to finish
+	runPosted();
+
+	MotionControl* running = motion;
+	if (running == nullptr) return false;
+	if (running->cancel) return true;
+	if (running->deadline != 0 && now() >= running->deadline)
+	{
+		running->timedOut = true;
+		return true;
+	}
+	return false;
+}
+
+void Wheel::reportProgress(float progress)
+{
+	MotionControl* running = motion;
+	if (running == nullptr || progressDepth != 1 || std::this_thread::get_id() != commanderId) return;
+
+	if (progress < 0.0f) progress = 0.0f;
+	if (progress > 1.0f) progress = 1.0f;
+	running->progress = progress;
+	if (running->onProgress && std::abs(progress - running->reported) >= MOTION_PROGRESS_STEP)
+	{
+		running->reported = progress;
+		running->onProgress(progress);
+	}
+}
+
+MotionHandle Wheel::gotoAngleAsync(Sint16 angle, Uint16 level, Uint32 timeout, MotionProgress progress)
+{
+	return submit("gotoAngle " + std::to_string(angle), [this, angle, level]() { return gotoAngle(angle, level); }, timeout, progress);
+}
+
+MotionHandle Wheel::gotoAngleMdAsync(Sint32 angleMd, Uint16 level, Uint32 timeout, MotionProgress progress)
+{
+	return submit("gotoAngle " + std::to_string(angleMd / (float)MDEG_PER_DEGREE), [this, angleMd, level]() { return gotoAngleMd(angleMd, level); }, timeout, progress);
+}
+
+MotionHandle Wheel::moveToAsync(float angle, float maxVelocity, Uint32 timeout, MotionProgress progress)
+{
+	return submit("moveTo " + std::to_string(angle), [this, angle, maxVelocity]() { return moveTo(angle, maxVelocity); }, timeout, progress);
+}
+
+MotionHandle Wheel::followPathAsync(const std::vector<Waypoint>& waypoints, float maxVelocity, Uint32 timeout, MotionProgress progress)
+{
+	return submit("followPath " + std::to_string(waypoints.size()), [this, waypoints, maxVelocity]() { return followPath(waypoints, maxVelocity); }, timeout, progress);
+}
+
+MotionHandle Wheel::calibrateAsync(Uint32 timeout, MotionProgress progress)
+{
+	return submit("calibrate", [this]() { return calibrate(); }, timeout, progress);
+}
+
+MotionHandle Wheel::profileAsync(Uint32 timeout, MotionProgress progress)
+{
+	return submit("profile", [this]() { profile(); return true; }, timeout, progress);
+}
+
+MotionHandle Wheel::findJitterAsync(Uint32 timeout, MotionProgress progress)
+{
+	return submit("findJitter", [this]() { findJitter(); return true; }, timeout, progress);
+}
+
+// Start sampling the wheel position every periodUs
+bool Wheel::startSampler(Uint32 periodUs)
+{
+	if (joy == nullptr || periodUs == 0) return false;
+
+	stopSampler();
+
+	samplePeriod = periodUs;
+	sampleCount = 0;
+	capture.configure(SDL_JoystickNumAxes(joy), SDL_JoystickNumButtons(joy), SDL_JoystickNumHats(joy));
+	sampling = true;
+	sampler = std::thread(&Wheel::samplerLoop, this);
+	log("Sampler started every " + std::to_string(periodUs) + " uS");
+	return true;
+}
+
+void Wheel::stopSampler()
+{
+	if (!sampler.joinable()) return;
+
+	sampling = false;
+	sampler.join();
+	log("Sampler stopped after " + std::to_string(sampleCount) + " samples");
+}
+
+// Fixed rate loop - sleeps until the next period rather than for a period
+void Wheel::samplerLoop()
+{
+	Uint32 applied = realtimeVersion;
+	Uint32 spin = applyRealtime(LOOP_SAMPLER);
+	Uint64 period = samplePeriod * NS_PER_US;
+	Uint64 next = clockNow();
+	while (sampling)
+	{
+		if (applied != realtimeVersion)
+		{
+			applied = realtimeVersion;
+			spin = applyRealtime(LOOP_SAMPLER);
+		}
+
+		Uint64 woke = clockNow();
+		sample();
+		Uint64 done = clockNow();
+
+		// Overran whole periods - drop them rather than catch up in a burst
+		Uint64 due = next;
+		Uint64 skipped = done > next + period ? (done - next) / period : 0;
+		next += (skipped + 1) * period;
+		cycles[LOOP_SAMPLER].record(due, woke, done, skipped);
+		sleepUntil(next, std::min(spin, samplePeriod / 2));
+	}
+}
+
+// Called by the loop's own thread - returns the spin to use for its sleeps
+Uint32 Wheel::applyRealtime(int loop)
+{
+	RealtimeOptions options;
+	{
+		std::lock_guard<std::mutex> lock(realtimeLock);
+		options = realtime;
+	}
+	cycles[loop].setDeadline(options.deadlineUs);
+
+	// Back to normal if it was raised
+	if (!options.enabled)
+	{
+		if (realtimeRunning[loop].exchange(false)) realtimeThread(0, REALTIME_ANY_CPU);
+		return 0;
+	}
+
+	// Command thread one below so the sampler always gets in first
+	int priority = loop == LOOP_SAMPLER ? options.priority : options.priority - 1;
+	int cpu = loop == LOOP_SAMPLER ? options.samplerCpu : options.controlCpu;
+	int result = realtimeThread(priority, cpu);
+	realtimeRunning[loop] = result == 0;
+	if (result != 0)
+	{
+		log("Error: Could not make the " + std::string(loop == LOOP_SAMPLER ? "sampler" : "command thread") + " real-time (" + std::to_string(result) + ")");
+		return options.spinUs;
+	}
+
+	realtimePrefaultStack();
+	log(std::string(loop == LOOP_SAMPLER ? "Sampler" : "Command thread") + " real-time at priority " + std::to_string(priority)
+		+ (cpu == REALTIME_ANY_CPU ? "" : " on CPU " + std::to_string(cpu)));
+	return options.spinUs;
+}
+
+// Command thread - while it is FIFO its sleeps spin no longer than the
+// options allow, or a 2 mS PLAN_PERIOD would be spent entirely spinning
+void Wheel::applyControlRealtime()
+{
+	Uint32 spin = applyRealtime(LOOP_CONTROL);
+	controlSpin = realtimeRunning[LOOP_CONTROL] ? std::min(spin, PLAN_PERIOD / 2) : CLOCK_SPIN;
+}
+
+// Spin for a wait on this thread
+Uint32 Wheel::waitSpin()
+{
+	return std::this_thread::get_id() == commanderId ? controlSpin : CLOCK_SPIN;
+}
+
+bool Wheel::setRealtime(const RealtimeOptions& options)
+{
+	if (options.enabled && (options.priority < 2 || options.priority > 99))
+	{
+		log("Error: Real-time priority must be 2 - 99");
+		return false;
+	}
+
+	bool ok = true;
+	bool wasLocked;
+	{
+		std::lock_guard<std::mutex> lock(realtimeLock);
+		wasLocked = realtime.enabled && realtime.lockMemory;
+		realtime = options;
+	}
+
+	// Whole process - done here rather than by either loop
+	bool lock = options.enabled && options.lockMemory;
+	if (lock != wasLocked)
+	{
+		int result = realtimeLockMemory(lock);
+		if (result != 0)
+		{
+			log("Error: Could not " + std::string(lock ? "lock" : "unlock") + " memory (" + std::to_string(result) + ")");
+			ok = !lock;
+		}
+	}
+
+	// The sampler picks the change up on its next cycle, the command thread between commands
+	realtimeVersion++;
+	if (commanderStarted) post([this]() { applyControlRealtime(); return 0; });
+	return ok;
+}
+
+bool Wheel::isRealtime(int loop)
+{
+	return (loop == LOOP_SAMPLER || loop == LOOP_CONTROL) && realtimeRunning[loop];
+}
+
+CycleStats Wheel::getCycleStats(int loop)
+{
+	if (loop != LOOP_SAMPLER && loop != LOOP_CONTROL) return CycleStats();
+	return cycles[loop].getStats();
+}
+
+size_t Wheel::getCycleHistory(int loop, Uint32* lateness, size_t max)
+{
+	if (loop != LOOP_SAMPLER && loop != LOOP_CONTROL) return 0;
+	return cycles[loop].history(lateness, max);
+}
+
+void Wheel::resetCycleStats()
+{
+	cycles[LOOP_SAMPLER].reset();
+	cycles[LOOP_CONTROL].reset();
+}
+
+// Take one sample from the device - everything from one update
+void Wheel::sample()
+{
+	Sint16 axes[CAPTURE_AXES];
+	Uint32 buttons = 0;
+	Uint8 hats[CAPTURE_HATS];
+	{
+		std::lock_guard<std::mutex> lock(deviceLock);
+		SDL_JoystickUpdate();
+		axes[AXIS_WHEEL] = SDL_JoystickGetAxis(joy, 0);
+		for (int a = 1; a < capture.getAxisCount(); ++a) axes[a] = SDL_JoystickGetAxis(joy, a);
+		for (int b = 0; b < capture.getButtonCount(); ++b) buttons |= (Uint32)(SDL_JoystickGetButton(joy, b) != 0) << b;
+		for (int h = 0; h < capture.getHatCount(); ++h) hats[h] = SDL_JoystickGetHat(joy, h);
+	}
+	Uint64 time = clockStamp();
+	capture.record(time, axes, buttons, hats);
+
+	Sint16 position = axes[AXIS_WHEEL];
+	if (recording) recorder.sample(time, position);
+	processSample(position, time);
+}
+
+// Update the estimate and publish - fed by the sampler or by replay
+void Wheel::processSample(Sint16 position, Uint64 time)
+{
+	estimator.update(position, time);
+	sampleCount++;
+
+	// Measure noise whenever nothing has pushed the wheel for a while
+	expireEffects(time);
+	if ((activeEffects & DRIVE_EFFECTS) || time < instancesDriveUntil) lastDriven = time;
+	bool idle = time - lastDriven >= NOISE_SETTLE * NS_PER_MS;
+	if (noise.sample(position, idle)) estimator.setNoise(noise.at(position).variance);
+
+	settle.sample(position, time, settle.getBand() == SETTLE_AUTO_BAND ? noiseBand(position) + JITTER_MARGIN : 0);
+
+	// Walls push back from this sample, not when the caller next looks - and
+	// from where the wheel will be by the time the force acts. Flagged so
+	// clearing can wait for a send in progress - see retireSamplerEffect()
+	int wall = 0;
+	samplerSending = true;
+	if (endStops.isEnabled())
+	{
+		WheelEstimate ahead = predictAt(time + predictionLatency * NS_PER_US);
+		float cpd = countsPerDegree;
+		if (endStops.evaluate(ahead.position / cpd, position / cpd, wall)) pushEndStop(wall, time);
+	}
+	if (wall != 0) lastDriven = time;
+
+	// Newest streamed force - older ones were never worth sending
+	int stream = streamId;
+	if (stream != EFFECT_ERROR)
+	{
+		pushStreamForce(stream);
+		if (streamForce.constant.level != 0) lastDriven = time;
+	}
+	samplerSending = false;
+
+	if (publishing)
+	{
+		WheelStateSnapshot state;
+		state.sample = sampleCount;
+		state.timestamp = time;
+		state.position = position;
+		state.angle = position / countsPerDegree;
+		state.velocity = estimator.at(time).velocity;
+		state.activeEffects = activeEffects;
+		statePublisher.publish(state);
+	}
+}
+
+// Timed runs end on the device without telling anyone - clear their bits
+// once past the end. A run started again meanwhile has a new end, and
+// gets its bit back.
+void Wheel::expireEffects(Uint64 time)
+{
+	Uint32 active = activeEffects;
+	for (unsigned int slot = 0; slot <= MAX_EFFECT_NUMBER; ++slot)
+	{
+		Uint32 bit = 1u << slot;
+		if (!(active & bit)) continue;
+
+		Uint64 end = shadows[slot].ends;
+		if (end == 0 || time < end + EFFECT_END_MARGIN * NS_PER_MS) continue;
+
+		activeEffects &= ~bit;
+		if (shadows[slot].ends != end) activeEffects |= bit;
+	}
+}
+
+// Velocity in counts per second from the sampler
+float Wheel::getVelocity()
+{
+	return estimator.at(now()).velocity;
+}
+
+WheelEstimate Wheel::getEstimate()
+{
+	return estimator.at(now());
+}
+
+WheelPrediction Wheel::predict(Uint32 latencyUs)
+{
+	if (latencyUs == PREDICT_AUTO) latencyUs = predictionLatency;
+
+	WheelPrediction p;
+	p.latency = latencyUs;
+	p.time = now() + latencyUs * NS_PER_US;
+	WheelEstimate e = predictAt(p.time);
+	if (!e.valid) return p;
+
+	float cpd = countsPerDegree;
+	p.angle = (e.position + OFFSET) / cpd;
+	p.velocity = e.velocity / cpd;
+	p.acceleration = e.acceleration / cpd;
+	p.angleSd = e.positionSd / cpd;
+	p.valid = true;
+	return p;
+}
+
+// The estimate carried on to time. Constant acceleration, except the
+// motor can't drive past its profiled top speed - it reaches it then holds.
+WheelEstimate Wheel::predictAt(Uint64 time)
+{
+	WheelEstimate e = estimator.at(time);
+	WheelEstimate last = estimator.at(0);
+	if (!e.valid || time <= last.time) return e;
+
+	// Already going faster than profiled - the table is wrong, not the wheel
+	float limit = std::max(topSpeed(), std::abs(last.velocity));
+	if (std::abs(e.velocity) <= limit) return e;
+
+	float dt = (time - last.time) / 1.0e9f;
+	float v = e.velocity > 0 ? limit : -limit;
+	float reach = last.acceleration != 0.0f ? (v - last.velocity) / last.acceleration : 0.0f;
+	reach = std::min(std::max(reach, 0.0f), dt);
+
+	e.position = last.position + last.velocity * reach + 0.5f * last.acceleration * reach * reach + v * (dt - reach);
+	e.velocity = v;
+	e.acceleration = 0.0f;
+	return e;
+}
+
+float Wheel::topSpeed()
+{
+	return profiledTopSpeed;
+}
+
+// Kept when the tables change - the sampler reads it every sample while
+// profile() may be writing them
+void Wheel::cacheTopSpeed()
+{
+	int fastest = 0;
+	for (int lvl = 0; lvl < 33; ++lvl) fastest = std::max(fastest, std::max(effectLevelsLeft[lvl], effectLevelsRight[lvl]));
+	profiledTopSpeed = fastest * 100.0f; // profiled per 10 mS
+}
+
+// Time from sending a force to the sampler seeing the wheel move, both
+// ways - the median is used for prediction from then on
+Uint32 Wheel::measureLatency()
+{
+	if (!checkHaptic()) return 0;
+	log("Measuring force to position latency...");
+
+	std::vector<Uint64> steps;
+	for (int i = 0; i < PREDICT_TRIALS && !cancelled(); ++i)
+	{
+		Uint64 latency = stepLatency(i % 2 == 0 ? RIGHT : LEFT);
+		if (latency != 0) steps.push_back(latency);
+	}
+	stopEffect(TRAJECTORY_FORCE);
+
+	if (steps.empty())
+	{
+		log("Error: No movement seen - latency not measured");
+		return 0;
+	}
+
+	std::sort(steps.begin(), steps.end());
+	Uint32 latency = (Uint32)(steps[steps.size() / 2] / NS_PER_US);
+	predictionLatency = latency;
+	log("Force to position latency " + std::to_string(latency) + " uS (" + std::to_string(steps.size()) + " steps)");
+	return latency;
+}
+
+// One step - nS from the force going out to the first sample outside the noise band, 0 if none
+Uint64 Wheel::stepLatency(int dir)
+{
+	waitSettled(PROFILE_SETTLE_TIMEOUT);
+
+	// Uploaded and running at nothing first so the step is one update
+	if (!driveTrajectory(0)) return 0;
+	waitNoLog(PROFILE_INTERVAL);
+
+	Sint16 from = getPosition();
+	Sint16 band = noiseBand(from) + JITTER_MARGIN;
+	if (!driveTrajectory(dir == RIGHT ? PREDICT_STEP_LEVEL : -PREDICT_STEP_LEVEL)) return 0;
+	Uint64 sent = now();
+	waitNoLog(PREDICT_STEP_TIME);
+	driveTrajectory(0);
+
+	// First reading after the force went out that has moved
+	Sint16 values[CAPTURE_HISTORY];
+	Uint64 times[CAPTURE_HISTORY];
+	size_t n = getAxisHistory(AXIS_WHEEL, values, times, (size_t)std::min<Uint64>(CAPTURE_HISTORY, PREDICT_STEP_TIME * 1000 / samplePeriod + 10));
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (times[i] > sent && std::abs(values[i] - from) > band) return times[i] - sent;
+	}
+	return 0;
+}
+
+void Wheel::setPredictionLatency(Uint32 latencyUs)
+{
+	predictionLatency = latencyUs == PREDICT_AUTO ? PREDICT_LATENCY : latencyUs;
+}
+
+Uint32 Wheel::getPredictionLatency()
+{
+	return predictionLatency;
+}
+
+NoiseEstimate Wheel::getNoise()
+{
+	return noise.at(getPosition());
+}
+
+bool Wheel::getSnapshot(CaptureSnapshot& snapshot)
+{
+	return capture.latest(snapshot);
+}
+
+size_t Wheel::getAxisHistory(int axis, Sint16* values, Uint64* times, size_t count)
+{
+	return capture.history(axis, values, times, count);
+}
+
+size_t Wheel::getButtonEvents(Uint64& cursor, ButtonEvent* events, size_t max)
+{
+	return capture.buttonEvents(cursor, events, max);
+}
+
+// Noise band at position - measured while idle, else the worst
+// measured anywhere, else what findJitter() found
+Sint16 Wheel::noiseBand(Sint16 position)
+{
+	NoiseEstimate e = noise.at(position);
+	if (!e.valid) e = noise.worst();
+	return e.valid ? e.peakToPeak : jitter;
+}
+
+// Make sampled state available to other processes
+bool Wheel::publishState(const std::string& name)
+{
+	if (publishing) return true;
+
+	if (!statePublisher.create(name))
+	{
+		log("Error: Could not create shared state (" + name + ")");
+		return false;
+	}
+
+	publishing = true;
+	log("Publishing wheel state to (" + name + ")");
+	return true;
+}
+
+// Start recording commands and positions to file
+bool Wheel::startRecording(const std::string& file)
+{
+	if (replaying != nullptr) return false;
+
+	stopRecording();
+	if (!recorder.open(file, now(), deviceQuery(), leftLock, rightLock, centre, jitter, hapticGain, randomSeed))
+	{
+		log("Error: Could not open recording (" + file + ")");
+		return false;
+	}
+
+	recording = true;
+	log("Recording session to (" + file + ")");
+	return true;
+}
+
+// Replaying - the end of the recorded session
+void Wheel::stopRecording()
+{
+	if (replaying != nullptr) replaying->finish(virtualTime);
+	if (!recording) return;
+
+	recording = false;
+	recorder.close();
+	log("Recording stopped");
+}
+
+Uint64 Wheel::now()
+{
+	if (replaying != nullptr) return virtualTime;
+	return clockNow();
+}
+
+// Move virtual time on, feeding the recorded positions through the
+// same path the sampler uses
+void Wheel::advance(Uint64 nS)
+{
+	virtualTime += nS;
+	while (nextSampleTime <= virtualTime)
+	{
+		processSample(replaying->positionAt(nextSampleTime), nextSampleTime);
+		nextSampleTime += samplePeriod * 1000ull;
+	}
+}
+
+// Wait until time (nS) - spins the last part, at most maxSpin uS, to keep getDistance() precise
+void Wheel::waitUntil(Uint64 time, Uint32 maxSpin)
+{
+	if (replaying != nullptr)
+	{
+		if (time > virtualTime) advance(time - virtualTime);
+		return;
+	}
+	sleepUntil(time, std::min(waitSpin(), maxSpin));
+}
+
+// Short description of an effect - used to compare command streams
+std::string Wheel::describeEffect(const SDL_HapticEffect& e)
+{
+	switch (e.type)
+	{
+	case SDL_HAPTIC_CONSTANT:
+		return "constant dir=" + std::to_string(e.constant.direction.dir[0]) + " len=" + std::to_string(e.constant.length)
+			+ " lvl=" + std::to_string(e.constant.level) + " dly=" + std::to_string(e.constant.delay)
+			+ " env=" + std::to_string(e.constant.attack_length) + "/" + std::to_string(e.constant.attack_level)
+			+ "/" + std::to_string(e.constant.fade_length) + "/" + std::to_string(e.constant.fade_level);
+	case SDL_HAPTIC_SINE:
+	case SDL_HAPTIC_TRIANGLE:
+	case SDL_HAPTIC_SAWTOOTHUP:
+	case SDL_HAPTIC_SAWTOOTHDOWN:
+		return "periodic " + std::to_string(e.type) + " dir=" + std::to_string(e.periodic.direction.dir[0]) + "," + std::to_string(e.periodic.direction.dir[1])
+			+ " len=" + std::to_string(e.periodic.length) + " per=" + std::to_string(e.periodic.period)
+			+ " mag=" + std::to_string(e.periodic.magnitude) + " off=" + std::to_string(e.periodic.offset);
+	case SDL_HAPTIC_SPRING:
+	case SDL_HAPTIC_DAMPER:
+	case SDL_HAPTIC_INERTIA:
+	case SDL_HAPTIC_FRICTION:
+		return "condition " + std::to_string(e.type) + " len=" + std::to_string(e.condition.length)
+			+ " sat=" + std::to_string(e.condition.right_sat[0]) + "/" + std::to_string(e.condition.left_sat[0])
+			+ " coeff=" + std::to_string(e.condition.right_coeff[0]) + "/" + std::to_string(e.condition.left_coeff[0])
+			+ " dead=" + std::to_string(e.condition.deadband[0]) + " centre=" + std::to_string(e.condition.center[0]);
+	case SDL_HAPTIC_RAMP:
+		return "ramp dir=" + std::to_string(e.ramp.direction.dir[0]) + " len=" + std::to_string(e.ramp.length)
+			+ " start=" + std::to_string(e.ramp.start) + " end=" + std::to_string(e.ramp.end);
+	}
+	return "type " + std::to_string(e.type);
+}
+
+// Match a command against the session and charge its recorded time
+int Wheel::replayCommand(const std::string& command, int fallback)
+{
+	Uint64 duration;
+	int result = replaying->command(virtualTime, command, fallback, duration);
+	advance(duration);
+	return result;
+}
+
+void Wheel::recordCommand(Uint64 start, const std::string& command, int result)
+{
+	recorder.command(start, now() - start, result, command);
+}
+
+unsigned int Wheel::deviceQuery()
+{
+	if (replaying != nullptr) return replaying->capabilities;
+	return capabilities;
+}
+
+Sint16 Wheel::deviceAxis()
+{
+	if (replaying != nullptr)
+	{
+		advance(replaying->readCost);
+		return replaying->positionAt(virtualTime);
+	}
+
+	Uint64 start = now();
+	Sint16 position;
+	{
+		std::lock_guard<std::mutex> lock(deviceLock);
+		SDL_JoystickUpdate();
+		position = SDL_JoystickGetAxis(joy, 0);
+	}
+
+	if (recording)
+	{
+		Uint64 end = now();
+		recorder.read(end - start);
+		recorder.sample(end, position);
+	}
+	return position;
+}
+
+// Wait for the next command slot - not when replaying, the recording has the timing
+void Wheel::paceCommand()
+{
+	Uint64 slot = commandRate.reserve(clockNow());
+	if (slot > clockNow()) sleepUntil(slot, REALTIME_SPIN);
+}
+
+int Wheel::deviceNew(unsigned int type, SDL_HapticEffect* e)
+{
+	if (replaying != nullptr) return replayCommand("new " + std::to_string(type) + " " + describeEffect(*e), replayEffectId++);
+
+	paceCommand();
+	Uint64 start = now();
+	int result;
+	{
+		std::lock_guard<std::mutex> lock(hapticLock);
+		result = SDL_HapticNewEffect(haptic, e);
+	}
+	if (recording) recordCommand(start, "new " + std::to_string(type) + " " + describeEffect(*e), result);
+	return result;
+}
+
+int Wheel::deviceUpdate(unsigned int type, int id, SDL_HapticEffect* e, bool reserved)
+{
+	if (replaying != nullptr) return replayCommand("update " + std::to_string(type) + " " + describeEffect(*e), 0);
+
+	if (!reserved) paceCommand();
+	Uint64 start = now();
+	int result;
+	{
+		// The sampler never waits behind the command thread - busy is a refusal it sends again
+		std::unique_lock<std::mutex> lock(hapticLock, std::defer_lock);
+		if (reserved)
+		{
+			if (!lock.try_lock()) return -1;
+		}
+		else lock.lock();
+		result = SDL_HapticUpdateEffect(haptic, id, e);
+	}
+	if (recording) recordCommand(start, "update " + std::to_string(type) + " " + describeEffect(*e), result);
+	return result;
+}
+
+int Wheel::deviceRun(unsigned int type, int id, Uint32 iterations)
+{
+	if (replaying != nullptr) return replayCommand("run " + std::to_string(type) + " " + std::to_string(iterations), 0);
+
+	paceCommand();
+	Uint64 start = now();
+	int result;
+	{
+		std::lock_guard<std::mutex> lock(hapticLock);
+		result = SDL_HapticRunEffect(haptic, id, iterations);
+	}
+	if (recording) recordCommand(start, "run " + std::to_string(type) + " " + std::to_string(iterations), result);
+	return result;
+}
+
+int Wheel::deviceStop(unsigned int type, int id)
+{
+	if (replaying != nullptr) return replayCommand("stop " + std::to_string(type), 0);
+
+	paceCommand();
+	Uint64 start = now();
+	int result;
+	{
+		std::lock_guard<std::mutex> lock(hapticLock);
+		result = SDL_HapticStopEffect(haptic, id);
+	}
+	if (recording) recordCommand(start, "stop " + std::to_string(type), result);
+	return result;
+}
+
+void Wheel::deviceDestroy(unsigned int type, int id)
+{
+	if (replaying != nullptr)
+	{
+		replayCommand("destroy " + std::to_string(type), 0);
+		return;
+	}
+
+	paceCommand();
+	Uint64 start = now();
+	{
+		std::lock_guard<std::mutex> lock(hapticLock);
+		SDL_HapticDestroyEffect(haptic, id);
+	}
+	if (recording) recordCommand(start, "destroy " + std::to_string(type), 0);
+}
+
+// Status is an input - replayed by time like position. Falls back to
+// what was last run or stopped before the first recorded status.
+int Wheel::deviceStatus(unsigned int type, int id)
+{
+	if (replaying != nullptr)
+	{
+		advance(replaying->readCost);
+		return replaying->statusAt(type, virtualTime, (activeEffects >> type) & 1);
+	}
+
+	Uint64 start = now();
+	int result;
+	{
+		std::lock_guard<std::mutex> lock(hapticLock);
+		result = SDL_HapticGetEffectStatus(haptic, id);
+	}
+	if (recording)
+	{
+		Uint64 end = now();
+		recorder.read(end - start);
+		recorder.status(end, type, result);
+	}
+	return result;
+}
+
+int Wheel::devicePause(bool pause)
+{
+	const char* command = pause ? "pause" : "unpause";
+	if (replaying != nullptr) return replayCommand(command, 0);
+
+	paceCommand();
+	Uint64 start = now();
+	int result;
+	{
+		std::lock_guard<std::mutex> lock(hapticLock);
+		result = pause ? SDL_HapticPause(haptic) : SDL_HapticUnpause(haptic);
+	}
+	if (recording) recordCommand(start, command, result);
+	return result;
+}
+
+int Wheel::deviceGain(int gain)
+{
+	if (replaying != nullptr) return replayCommand("gain " + std::to_string(gain), 0);
+
+	paceCommand();
+	Uint64 start = now();
+	int result;
+	{
+		std::lock_guard<std::mutex> lock(hapticLock);
+		result = SDL_HapticSetGain(haptic, gain);
+	}
+	if (recording) recordCommand(start, "gain " + std::to_string(gain), result);
+	return result;
+}
@@ -19,7 +19,27 @@ Version 0.1
 #include <ratio>
 #include <cstdlib> // random number
 //#include <SDL_stdinc.h> // setMaxGain()
-#include <sstream> // getMaxGain()
+#include <thread> // sampler
+#include <mutex>
+#include <atomic>
+#include "WheelState.h"
+#include "Recorder.h"
+#include "Trajectory.h"
+#include "Motion.h"
+#include "Clock.h"
+#include "Estimator.h"
+#include "Noise.h"
+#include "Settle.h"
+#include "Capture.h"
+#include "EffectPool.h"
+#include "CommandQueue.h"
+#include "EndStop.h"
+#include "Realtime.h"
+#include "Rate.h"
+#include "Mailbox.h"
+#include <deque>
+#include <vector>
+#include <condition_variable>
 
 
 /*
@@ -29,12 +49,11 @@ Version 0.1
 
 
 //const float force_scale = 0.2; // for SIM STEER
-const float FORCE_SCALE = 1.0f; // for G27 - leave at one and use setGain() setMaxGain()
+constexpr float FORCE_SCALE = 1.0f; // for G27 - leave at one and use setGain() setMaxGain()
 
 constexpr Sint16 DEGREES = 900;
 constexpr auto OFFSET = 0;
 constexpr auto JITTER_MARGIN = 5;
-constexpr auto STATIONARY_TESTS = 2;
 constexpr auto RATED_HAPTIC_FORCE = 1.6; // in Newton metres
 
 // G27 10mS move counts for each effect level
@@ -59,7 +78,10 @@ constexpr unsigned int INERTIA = 8;
 constexpr unsigned int FRICTION = 9;
 constexpr unsigned int RAMP_LEFT = 10;
 constexpr unsigned int RAMP_RIGHT = 11;
-constexpr unsigned int MAX_EFFECT_NUMBER = 11;
+constexpr unsigned int TELEMETRY_FORCE = 12;
+constexpr unsigned int TELEMETRY_TEXTURE = 13;
+constexpr unsigned int TRAJECTORY_FORCE = 14;
+constexpr unsigned int MAX_EFFECT_NUMBER = 14;
 
 constexpr unsigned int UP = 3;
 constexpr unsigned int DOWN = 4;
@@ -114,22 +136,125 @@ constexpr auto MIN_CENTRE = -32768;
 constexpr unsigned int MIN_EFFECT_NUMBER = 0;
 
 constexpr auto DIRECTION_TYPE = SDL_HAPTIC_CARTESIAN; // Only Catesian supported
+constexpr Uint32 EFFECT_END_MARGIN = 20; // mS either side of a timed run's end where the device is asked
+constexpr unsigned int INSTANCE_TYPE = 100; // handle n is recorded as effect INSTANCE_TYPE + n
+constexpr unsigned int ENDSTOP_TYPE = 90; // end-stop force is recorded as this effect
+constexpr unsigned int RATE_TYPE = 91; // effects timed by characteriseRates()
+constexpr unsigned int STREAM_TYPE = 92; // streamed force is recorded as this effect
+
+// Sampler
+constexpr Uint32 SAMPLE_PERIOD = 1000; // uS
+constexpr int REPLAY_EFFECT_ID = 1000; // ids handed out when replay has diverged
+
+// Trajectory following
+constexpr Uint32 PLAN_PERIOD = 2000; // uS between force updates
+constexpr Uint32 PLAN_SPIN = REALTIME_SPIN; // uS spun before each update - CLOCK_SPIN would be the whole period
+constexpr float FEEDFORWARD_LEAD = 0.02f; // S - force builds up this far behind the command
+constexpr float PLAN_POSITION_GAIN = 1500.0f; // level per degree behind the trajectory
+constexpr float PLAN_VELOCITY_GAIN = 150.0f; // level per deg/S slower than the trajectory
+constexpr float PLAN_TOLERANCE = 1.0f; // degrees
+constexpr float PLAN_SETTLED_VELOCITY = 5.0f; // deg/S
+constexpr Uint32 PLAN_SETTLE_TIME = 500; // mS allowed after the trajectory ends
+constexpr float PATH_TOLERANCE = 2.0f; // degrees off the path counted as a waypoint missed
+
+// Effects that push the wheel - noise is only measured with none running
+constexpr Uint32 DRIVE_EFFECTS = (1u << LEFT) | (1u << RIGHT) | (1u << SINE) | (1u << TRIANGLE) | (1u << SAWUP) | (1u << SAWDOWN)
+	| (1u << RAMP_LEFT) | (1u << RAMP_RIGHT) | (1u << TELEMETRY_FORCE) | (1u << TELEMETRY_TEXTURE) | (1u << TRAJECTORY_FORCE);
+constexpr Uint32 NOISE_SETTLE = 300; // mS after the last drive effect before the wheel counts as idle
+
+// Profiling
+constexpr auto PROFILE_READINGS = 5; // estimated velocity readings averaged per level
+constexpr Uint32 PROFILE_INTERVAL = 10; // mS between readings
+constexpr Uint32 PROFILE_SETTLE_TIMEOUT = 5000; // mS to wait for the wheel to stop between levels
+
+// Startup
+constexpr Uint32 STARTUP_SETTLE_HOLD = 750; // mS still before the driver counts as done centring
+constexpr Uint32 STARTUP_SETTLE_TIMEOUT = 7000; // mS - carry on anyway after this
+
+// Millidegree angles - the axis resolves about 1/73 of a degree
+constexpr Sint32 MDEG_PER_DEGREE = 1000;
+constexpr Sint32 GOTO_TOLERANCE = 500; // mdeg either side of the target
+
+// Prediction - how far ahead a force sent now acts
+constexpr Uint32 PREDICT_AUTO = SDL_MAX_UINT32; // use the measured or set latency
+constexpr Uint32 PREDICT_LATENCY = 10000; // uS - one USB report, until measured
+constexpr int PREDICT_TRIALS = 5; // steps timed by measureLatency()
+constexpr Uint16 PREDICT_STEP_LEVEL = SLOW;
+constexpr Uint32 PREDICT_STEP_TIME = 150; // mS each step is held
 
 // stuff for log
 constexpr auto SCREEN = 1;
 constexpr auto TEXT_FILE = 2;
 constexpr auto LOG_FILE = "G27_log.txt";
 
+struct EffectDescriptor; // Effect.h
+
+// How long each part of opening the device took - nS
+struct StartupTiming
+{
+	Uint64 init = 0;		// SDL_Init
+	Uint64 open = 0;		// finding and opening the joystick
+	Uint64 haptic = 0;		// opening the haptic device
+	Uint64 settle = 0;		// waiting for the driver to stop moving the wheel
+	Uint64 gain = 0;		// setting the gains
+	Uint64 total = 0;
+	bool settled = false;	// false if STARTUP_SETTLE_TIMEOUT ran out
+};
+
+// Where the wheel will be - degrees, +ve right
+struct WheelPrediction
+{
+	Uint64 time = 0;			// nS the prediction is for
+	Uint32 latency = 0;			// uS ahead of now
+	float angle = 0.0f;
+	float velocity = 0.0f;		// deg/S
+	float acceleration = 0.0f;	// deg/S/S
+	float angleSd = 0.0f;		// one standard deviation
+	bool valid = false;			// false until the first sample
+};
+
+// How closely followPath() kept to the path - errors in degrees, +ve
+// when the wheel is left of where it should be
+struct PathStats
+{
+	Uint64 cycles = 0;
+	float planned = 0.0f;		// S
+	float taken = 0.0f;			// S including settling
+	float meanError = 0.0f;		// of the magnitude
+	float rmsError = 0.0f;
+	float maxError = 0.0f;		// magnitude
+	float lastError = 0.0f;		// newest cycle - read while following
+	float finalError = 0.0f;	// from the last waypoint once settled
+	std::vector<float> waypointErrors; // as each waypoint's time passed
+	Uint32 missed = 0;			// waypoints more than PATH_TOLERANCE off
+	bool running = false;
+};
+
+// Effect commands sent to the device and skipped because they would
+// not have changed anything
+struct EffectStats
+{
+	Uint64 uploads = 0, uploadsElided = 0; // including updates
+	Uint64 runs = 0, runsElided = 0;
+	Uint64 stops = 0, stopsElided = 0;
+	Uint64 queries = 0, queriesElided = 0; // status
+};
+
 class Wheel
 {
 private:
 	bool debug;
 	int deviceNumber;
 	bool hasHaptic;
+	unsigned int capabilities; // SDL_HapticQuery() when opened
+	StartupTiming startup;
+	void startupPhase(Uint64& duration, Uint64& phase);
 	Sint16 leftLock, rightLock, centre;
 	Sint16 jitter;
-	char const* MAXIMUM_GAIN; // place holder for env variable
+	int maxGain; // SDL_HAPTIC_GAIN_MAX as last set
 	int hapticGain;
+	double levelToForce, forceToLevel; // Nm per level and back at the current gains
+	void updateConversion();
 
 	// init profiles with calibrated levels
 	int effectLevelsLeft[33] = { 0, M1, M2, M3, M4, M5, M6, M7, M8, M9, M10, M11, M12, M13, M14, M15, M16, M17, M18, M19, M20
@@ -141,6 +266,128 @@ private:
 	SDL_Haptic* haptic = nullptr;
 	SDL_HapticEffect effect;
 
+	// What the device was last sent for each effect - commands that
+	// would change nothing are skipped
+	struct EffectShadow
+	{
+		SDL_HapticEffect params;	// valid while uploaded
+		std::atomic<Uint64> ends;	// nS - end of the current run, 0 for ever - the sampler reads it
+	};
+	EffectShadow shadows[MAX_EFFECT_NUMBER + 1] = {};
+	EffectStats effectStats;
+	Uint64 effectEnd(const SDL_HapticEffect& e, Uint64 start, Uint32 iterations);
+
+	// Effects behind handles
+	EffectPool pool;
+	std::atomic<Uint64> instancesDriveUntil; // nS - sampler treats the wheel as driven until then
+	bool makeResident(Uint32 handle, EffectInstance& instance);
+	int deviceNewWithRoom(unsigned int type, SDL_HapticEffect* e);
+	void evict(Uint32 handle);
+	void releaseAllEffects();
+
+	// Scenes - one playing, one prepared behind it
+	std::vector<EffectHandle> scenes[2];
+	int frontScene;
+	int devicePause(bool pause);
+
+	// Telemetry effects are kept uploaded and updated in place
+	SDL_HapticEffect telemetryForce;
+	SDL_HapticEffect telemetryTexture;
+
+	// Trajectory force is kept uploaded and updated in place
+	SDL_HapticEffect trajectoryForce;
+
+	// Streamed force - posted by anyone, only the sampler sends it
+	ForceMailbox forceMailbox;
+	SDL_HapticEffect streamForce;
+	std::atomic<int> streamId;
+	Sint16 streamHeld;		// taken but not yet sent - sampler only
+	Uint64 streamHeldAt;	// nS posted
+	bool streamHolding;
+	void pushStreamForce(int id);
+
+	// Commands to the device are spaced to the rate it keeps up with
+	CommandRate commandRate;
+	void paceCommand();
+	RatePoint rateRun(int command, const SDL_HapticEffect& effect, Uint32 rate);
+
+	// End-stop force - set up by setEndStops(), then only the sampler sends it
+	EndStops endStops;
+	SDL_HapticEffect endStopForce;
+	std::atomic<int> endStopId;
+	void pushEndStop(int level, Uint64 time);
+
+	// Set while the sampler sends an effect it owns - the end-stop or stream
+	std::atomic<bool> samplerSending;
+	bool retireSamplerEffect(std::atomic<int>& slot, unsigned int type);
+
+	// Sampler thread - reads position at a fixed rate and publishes it
+	std::thread sampler;
+	std::atomic<bool> sampling;
+	std::mutex deviceLock; // SDL joystick access
+	std::mutex hapticLock; // SDL haptic calls - sampler and command thread both send, held only around the call
+	Uint32 samplePeriod;
+	Uint64 sampleCount;
+	Estimator estimator;
+	NoiseMonitor noise;
+	SettleDetector settle;
+	Capture capture;
+	Uint64 lastDriven; // sample time a drive effect was last running
+	std::atomic<float> countsPerDegree;
+	std::atomic<Uint32> activeEffects; // bit per effect number
+	std::atomic<bool> publishing;
+	StatePublisher statePublisher;
+
+	// Real-time running - each loop applies the options to itself when they change
+	RealtimeOptions realtime;
+	std::mutex realtimeLock;
+	std::atomic<Uint32> realtimeVersion;
+	std::atomic<bool> realtimeRunning[2];
+	CycleMonitor cycles[2]; // LOOP_SAMPLER, LOOP_CONTROL
+	Uint32 applyRealtime(int loop);
+	Uint32 controlSpin; // uS - command thread only
+	void applyControlRealtime();
+	Uint32 waitSpin();
+
+	// Prediction
+	std::atomic<Uint32> predictionLatency; // uS
+	float topSpeed(); // counts/S - fastest in the profile tables
+	std::atomic<float> profiledTopSpeed;
+	void cacheTopSpeed();
+	WheelEstimate predictAt(Uint64 time);
+	Uint64 stepLatency(int dir);
+
+	void samplerLoop();
+	void sample();
+	void processSample(Sint16 position, Uint64 time);
+	void expireEffects(Uint64 time);
+
+	// Record / replay - replaying is set when there is no device
+	Session* replaying;
+	Recorder recorder;
+	std::atomic<bool> recording;
+	Uint64 virtualTime;
+	Uint64 nextSampleTime;
+	int replayEffectId;
+	unsigned int randomSeed; // findJitter() angles - recorded so replay matches
+
+	void advance(Uint64 nS);
+	void waitUntil(Uint64 time, Uint32 maxSpin = CLOCK_SPIN);
+	std::string describeEffect(const SDL_HapticEffect& e);
+	int replayCommand(const std::string& command, int fallback);
+	void recordCommand(Uint64 start, const std::string& command, int result);
+
+	// All device access goes through these
+	unsigned int deviceQuery();
+	Sint16 deviceAxis();
+	int deviceNew(unsigned int type, SDL_HapticEffect* e);
+	int deviceUpdate(unsigned int type, int id, SDL_HapticEffect* e, bool reserved = false); // reserved - the caller holds a slot from tryReserve() and -1 is returned rather than wait for the haptic lock
+	int deviceRun(unsigned int type, int id, Uint32 iterations);
+	int deviceStop(unsigned int type, int id);
+	void deviceDestroy(unsigned int type, int id);
+	int deviceStatus(unsigned int type, int id);
+	int deviceGain(int gain);
+
 	// Sets hasHaptic variable
 	void testHapticAbilitiy();
 
@@ -177,6 +424,7 @@ private:
 	Sint16 findLeftLock();
 	Sint16 findRightLock();
 	Sint16 findJitter();
+	Sint16 noiseBand(Sint16 position);
 	void setDir(int dir, int& left_right, int& up_down);
 	void setPeriodType(int type, int& sdl_type);
 	void setConditionType(int type, int& sdl_type);
@@ -186,11 +434,55 @@ private:
 	bool setCondition(unsigned int type, Uint32 mS, Uint32 dly, Uint16 rSat, Uint16 lSat, Sint16 rCo, Sint16 lCo, Uint16 dead, Sint16 centre);
 	bool setRampForce(Uint32 mS, int dir, Uint32 dly, Sint16 start, Sint16 end, Uint32 aLen, Uint16 aLvl, Uint32 fLen, Uint16 fLvl, int type);
 
-	int setenv(const char* name, const char* value, int overwrite);
-	int uploadEffect();
+	int uploadEffect(unsigned int type);
 
 	Uint16 scaleLevel(Uint16 lvl);
-	void profileD(int dir);
+	bool profileD(int dir, int* table);
+
+	// Command thread - runs the async calls one at a time
+	struct MotionTask
+	{
+		std::shared_ptr<MotionControl> control;
+		std::function<void()> run;
+	};
+	std::thread commander;
+	std::mutex commandLock;
+	std::condition_variable commandReady;
+	std::deque<MotionTask> commands;
+	bool commanding;
+	std::atomic<bool> commanderStarted;
+	std::atomic<std::thread::id> commanderId; // set by the command thread itself - commander is only safe to touch under commandLock
+	CommandQueue<std::function<void()>> posted; // post() - run between and during motions
+	std::atomic<bool> commandIdle; // waiting on commandReady - producers must notify
+	bool servicing; // running posted commands - not re-entered
+	std::atomic<MotionControl*> motion; // running on the command thread
+	int progressDepth; // only the outermost operation reports progress
+
+	// Counts nesting so calibrate() reports progress but its gotoAngle() calls dont
+	struct ProgressScope
+	{
+		Wheel& wheel;
+		ProgressScope(Wheel& wheel) : wheel(wheel) { ++wheel.progressDepth; }
+		~ProgressScope() { --wheel.progressDepth; }
+	};
+
+	void commandLoop();
+	void startCommander();
+	void stopCommands();
+	void runPosted();
+	void wakeCommander();
+	MotionHandle submit(const std::string& name, std::function<bool()> task, Uint32 timeout, MotionProgress progress);
+	bool cancelled();
+	void reportProgress(float progress);
+
+	// Trajectory following
+	float levelVelocity(Uint16 level, int dir);
+	int feedForwardLevel(float velocity);
+	bool driveTrajectory(int level);
+	bool gotoAngleWithin(Sint32 angleMd, Uint16 level, Sint32 lowMd, Sint32 highMd);
+	bool trackReference(const std::function<MotionPoint(float)>& reference, float duration, float target, const std::function<void(float t, float error)>& tracked);
+	PathStats pathStats;
+	std::mutex pathLock;
 
 
 
@@ -207,7 +499,10 @@ private:
 	{ INERTIA	, EFFECT_ERROR },
 	{ FRICTION	, EFFECT_ERROR },
 	{ RAMP_LEFT	, EFFECT_ERROR },
-	{ RAMP_RIGHT , EFFECT_ERROR }
+	{ RAMP_RIGHT , EFFECT_ERROR },
+	{ TELEMETRY_FORCE , EFFECT_ERROR },
+	{ TELEMETRY_TEXTURE , EFFECT_ERROR },
+	{ TRAJECTORY_FORCE , EFFECT_ERROR }
 	};
 
 	// Store effect ID with its effect name
@@ -223,12 +518,16 @@ private:
 	{ INERTIA	, "Inertia Condition" },
 	{ FRICTION	, "Friction Condition" },
 	{ RAMP_LEFT , "Ramp Left" },
-	{ RAMP_RIGHT , "Ramp Right" }
+	{ RAMP_RIGHT , "Ramp Right" },
+	{ TELEMETRY_FORCE , "Telemetry Force" },
+	{ TELEMETRY_TEXTURE , "Telemetry Texture" },
+	{ TRAJECTORY_FORCE , "Trajectory Force" }
 	};
 
 public:
 	// Constructor / Destructor
 	Wheel(const std::string name, bool debug = false);
+	Wheel(Session& session, bool debug = false); // replay - no device
 	~Wheel();
 
 	// Haptic Abilities (bits 0-15)
@@ -253,6 +552,7 @@ public:
 
 	bool validDevice();
 	bool validHaptic();
+	StartupTiming getStartupTiming();
 	int numEffectsPlaying();
 	void resetEffect();
 	bool setLeft(Uint32 mS, Uint16 lvl);
@@ -270,19 +570,65 @@ public:
 	bool setRampLeft(Uint32 mS, Sint16 start, Sint16 end);
 	bool setRampRight(Uint32 mS, Sint16 start, Sint16 end);
 
+	// Prebuilt descriptor (Effect.h) - not checked again, updated in place when it can be
+	bool setEffect(const EffectDescriptor& descriptor);
+
 	Sint16 getPosition();
 	Sint16 getAngle();
 	Sint16 calculateAngle(Sint16 position);
 	Sint16 calculatePosition(float angle);
+	Sint32 getAngleMd(); // millidegrees, -ve left
+	Sint32 calculateAngleMd(Sint16 position);
+	Sint16 calculatePositionMd(Sint32 angleMd);
 	bool stopEffect(int effect);
 	bool isEffectRunning(int effect);
+	EffectStats getEffectStats();
+
+	// Any number of effects, kept on the device while there is room
+	EffectHandle createEffect(const EffectDescriptor& descriptor); // invalid handle on failure
+	bool updateEffect(EffectHandle handle, const EffectDescriptor& descriptor); // keeps playing
+	bool runEffect(EffectHandle handle, Uint32 iterations = 1);
+	bool stopEffect(EffectHandle handle);
+	bool isEffectRunning(EffectHandle handle);
+	void releaseEffect(EffectHandle handle);
+	int getEffectCapacity(); // device slots, including the numbered effects
+
+	// Upload a whole set of effects while the current one plays, then
+	// swap to it in one go - paused while swapping if the device can
+	bool prepareScene(const std::vector<EffectDescriptor>& effects);
+	bool swapScene(bool stopNumbered = false); // also stop LEFT, DAMPER etc.
+	void clearScenes();
 
 	bool calibrate();
 	bool gotoAngle(Sint16 angle, Uint16 level = NORMAL);
+	bool gotoAngleMd(Sint32 angleMd, Uint16 level = NORMAL, Sint32 toleranceMd = GOTO_TOLERANCE);
 	bool gotoAngleSlow(Sint16 angle);
 	bool gotoAngleFast(Sint16 angle);
 	bool gotoAngleFullSpeed(Sint16 angle);
 
+	// Run on the command thread - timeout in mS from when it starts, 0 = none
+	MotionHandle gotoAngleAsync(Sint16 angle, Uint16 level = NORMAL, Uint32 timeout = 0, MotionProgress progress = nullptr);
+	MotionHandle gotoAngleMdAsync(Sint32 angleMd, Uint16 level = NORMAL, Uint32 timeout = 0, MotionProgress progress = nullptr);
+	MotionHandle moveToAsync(float angle, float maxVelocity = 0.0f, Uint32 timeout = 0, MotionProgress progress = nullptr);
+	MotionHandle followPathAsync(const std::vector<Waypoint>& waypoints, float maxVelocity = 0.0f, Uint32 timeout = 0, MotionProgress progress = nullptr);
+	MotionHandle calibrateAsync(Uint32 timeout = 0, MotionProgress progress = nullptr);
+	MotionHandle profileAsync(Uint32 timeout = 0, MotionProgress progress = nullptr);
+	MotionHandle findJitterAsync(Uint32 timeout = 0, MotionProgress progress = nullptr);
+	void cancelMotion(); // running and queued
+
+	// Any thread - run a short command on the command thread, in order of
+	// posting. Runs between motions and at their cancellation points, so
+	// it doesn't wait for a long motion to finish. EFFECT_ERROR when full.
+	std::future<int> post(std::function<int()> command);
+	bool post(std::function<int()> command, std::function<void(int result)> done); // done runs on the command thread
+
+	// Follow a planned trajectory - velocity in deg/S, 0 uses the fastest profiled level
+	bool moveTo(float angle, float maxVelocity = 0.0f, float maxAcceleration = PLAN_ACCELERATION, float jerk = PLAN_JERK);
+
+	// Blend through waypoints without stopping at each - velocity in deg/S, 0 uses the fastest profiled level
+	bool followPath(const std::vector<Waypoint>& waypoints, float maxVelocity = 0.0f, float maxAcceleration = PLAN_ACCELERATION);
+	PathStats getPathStats(); // the path being followed, or the last one
+
 	void wait(Uint32 mS);
 	void waitNoLog(Uint32 mS);
 	bool runEffect(unsigned int effect, Uint32 iterations = 1);
@@ -298,17 +644,84 @@ public:
 	void log(std::string msg, int place = SCREEN);
 
 	std::string getTimeStr();
-	Sint16 getDistance(Uint32 time = 10);
+	Sint16 getDistance(Uint32 time = 10); // at the estimated velocity - doesn't block
 
-	bool isStationary();
+	bool isStationary(); // answers at once from the sampler
+
+	// Settled = within band counts for holdMs - band SETTLE_AUTO_BAND follows the measured noise
+	void setSettleBand(Uint16 band = SETTLE_AUTO_BAND, Uint32 holdMs = SETTLE_HOLD);
+	bool waitSettled(Uint32 timeoutMs); // true as soon as settled, false on timeout
+	void onSettled(SettleCallback callback); // nullptr to clear
 
 	double convertLevelToForce(Uint16 lvl);
 	Uint16 convertForceToLevel(float force);
 
+	// Whole buffers without logging - return how many were clamped
+	size_t convertLevelsToForces(const Uint16* levels, float* forces, size_t count);
+	size_t convertForcesToLevels(const float* forces, Uint16* levels, size_t count);
+
 	void profile();
 
 	Uint16 getClosestEffectLevel(int distance, int dir = LEFT);
 
+	// Sampler runs from construction - period in uS
+	bool startSampler(Uint32 periodUs = SAMPLE_PERIOD);
+	void stopSampler();
+
+	// SCHED_FIFO, pinning and locked memory for the sampler and command thread
+	bool setRealtime(const RealtimeOptions& options);
+	bool isRealtime(int loop); // LOOP_SAMPLER or LOOP_CONTROL - applied and running
+	CycleStats getCycleStats(int loop);
+	size_t getCycleHistory(int loop, Uint32* lateness, size_t max); // uS
+	void resetCycleStats();
+	float getVelocity();
+	WheelEstimate getEstimate(); // filtered position, velocity and acceleration now
+
+	// Where the wheel will be once a force sent now acts on it. Extrapolated
+	// from the estimate, held to the profiled top speed. Walls use it too.
+	WheelPrediction predict(Uint32 latencyUs = PREDICT_AUTO);
+	Uint32 measureLatency(); // times force steps - uS, 0 if it failed. Moves the wheel
+	void setPredictionLatency(Uint32 latencyUs);
+	Uint32 getPredictionLatency();
+	NoiseEstimate getNoise(); // measured while idle where the wheel is now
+
+	// Every axis, button and hat from the sampler - not in replay
+	bool getSnapshot(CaptureSnapshot& snapshot); // newest tick
+	size_t getAxisHistory(int axis, Sint16* values, Uint64* times, size_t count); // newest count, oldest first
+	size_t getButtonEvents(Uint64& cursor, ButtonEvent* events, size_t max); // start cursor at 0
+
+	// Publish sampled state to shared memory for other processes
+	bool publishState(const std::string& name = STATE_NAME);
+
+	// Record this session for replay later
+	bool startRecording(const std::string& file);
+	void stopRecording();
+
+	// Time in nS - virtual when replaying
+	Uint64 now();
+
+	// Signed level (+ve right), texture magnitude and period in mS (0 = off)
+	bool applyTelemetry(Sint16 level, Uint16 texture, Uint32 period);
+
+	// Time new, update and run for each effect type at rising rates - apply
+	// enforces RATE_MARGIN of the slowest fastest-sustained rate
+	bool characteriseRates(std::vector<RateResult>& results, bool apply = true);
+	void setCommandRate(Uint32 hz); // RATE_UNLIMITED for none
+	Uint32 getCommandRate();
+	CommandRateStats getCommandRateStats();
+
+	// Continuous force that can be set faster than the device takes it -
+	// the sampler sends only the newest level, at the command rate
+	bool startForceStream();
+	void postForce(Sint16 level); // +ve turns right - any thread, never blocks
+	void stopForceStream();
+	MailboxStats getForceStreamStats();
+
+	// Virtual walls in degrees, checked on every sample - ENDSTOP_NONE for no wall on a side
+	bool setEndStops(float left, float right, float stiffness = ENDSTOP_STIFFNESS, float hysteresis = ENDSTOP_HYSTERESIS, Uint16 maxLevel = ENDSTOP_MAX_LEVEL);
+	void clearEndStops();
+	EndStopStats getEndStopStats();
+
 
 };
 
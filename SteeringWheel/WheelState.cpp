@@ -0,0 +1,97 @@
+#include "WheelState.h"
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <new>
+
+StatePublisher::StatePublisher() : block(nullptr)
+{
+}
+
+// Create the shared block ready for readers
+bool StatePublisher::create(const std::string& name)
+{
+	if (!memory.create(name, sizeof(WheelStateBlock))) return false;
+
+	block = new (memory.data()) WheelStateBlock();
+	block->version = STATE_VERSION;
+	std::atomic_thread_fence(std::memory_order_release);
+	block->magic = STATE_MAGIC;
+	return true;
+}
+
+bool StatePublisher::isOpen() const
+{
+	return block != nullptr;
+}
+
+// Sequence lock write - odd sequence marks an update in progress
+void StatePublisher::publish(const WheelStateSnapshot& state)
+{
+	if (block == nullptr) return;
+
+	Uint32 seq = block->sequence.load(std::memory_order_relaxed);
+	block->sequence.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	block->sample.store(state.sample, std::memory_order_relaxed);
+	block->timestamp.store(state.timestamp, std::memory_order_relaxed);
+	block->position.store(state.position, std::memory_order_relaxed);
+	block->angle.store(state.angle, std::memory_order_relaxed);
+	block->velocity.store(state.velocity, std::memory_order_relaxed);
+	block->activeEffects.store(state.activeEffects, std::memory_order_relaxed);
+
+	block->sequence.store(seq + 2, std::memory_order_release);
+}
+
+StateReader::StateReader() : block(nullptr)
+{
+}
+
+// Attach to the block published by the process owning the Wheel
+bool StateReader::open(const std::string& name)
+{
+	if (!memory.open(name, sizeof(WheelStateBlock))) return false;
+
+	block = static_cast<const WheelStateBlock*>(memory.data());
+	if (block->magic != STATE_MAGIC || block->version != STATE_VERSION)
+	{
+		memory.close();
+		block = nullptr;
+		return false;
+	}
+	return true;
+}
+
+bool StateReader::tryRead(WheelStateSnapshot& state) const
+{
+	if (block == nullptr) return false;
+
+	Uint32 before = block->sequence.load(std::memory_order_acquire);
+	if (before & 1) return false;
+
+	state.sample = block->sample.load(std::memory_order_relaxed);
+	state.timestamp = block->timestamp.load(std::memory_order_relaxed);
+	state.position = (Sint16)block->position.load(std::memory_order_relaxed);
+	state.angle = block->angle.load(std::memory_order_relaxed);
+	state.velocity = block->velocity.load(std::memory_order_relaxed);
+	state.activeEffects = block->activeEffects.load(std::memory_order_relaxed);
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return block->sequence.load(std::memory_order_relaxed) == before;
+}
+
+bool StateReader::read(WheelStateSnapshot& state) const
+{
+	for (int i = 0; i < STATE_READ_RETRIES; ++i)
+	{
+		if (tryRead(state)) return true;
+	}
+	return false;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+#include <SDL.h>
+#include <atomic>
+#include <string>
+#include "SharedMemory.h"
+
+/*
+   Wheel state published by the sampler for other processes.
+   One writer (the Wheel's sampler), any number of readers.
+   Protected by a sequence lock - readers never block the writer
+   and never make a system call once the block is open.
+*/
+
+constexpr auto STATE_NAME = "G27State";
+constexpr Uint32 STATE_MAGIC = 0x47323753; // "G27S"
+constexpr Uint32 STATE_VERSION = 1;
+constexpr auto STATE_READ_RETRIES = 100;
+
+// Plain copy handed to readers
+struct WheelStateSnapshot
+{
+	Uint64 sample;			// sample number
+	Uint64 timestamp;		// nS, same clock as clockNow()
+	Sint16 position;		// raw axis count
+	float angle;			// degrees, -ve left
+	float velocity;			// counts per second
+	Uint32 activeEffects;	// bit n set if effect n is playing
+};
+
+// Layout of the shared block - every field is atomic so a torn
+// read is detected rather than undefined
+struct WheelStateBlock
+{
+	Uint32 magic;
+	Uint32 version;
+	std::atomic<Uint32> sequence;	// odd while being written
+	std::atomic<Uint64> sample;
+	std::atomic<Uint64> timestamp;
+	std::atomic<Sint32> position;
+	std::atomic<float> angle;
+	std::atomic<float> velocity;
+	std::atomic<Uint32> activeEffects;
+};
+
+// Writer side - owned by Wheel
+class StatePublisher
+{
+private:
+	SharedMemory memory;
+	WheelStateBlock* block;
+
+public:
+	StatePublisher();
+
+	bool create(const std::string& name = STATE_NAME);
+	bool isOpen() const;
+	void publish(const WheelStateSnapshot& state);
+};
+
+// Reader side - use from any local process
+class StateReader
+{
+private:
+	SharedMemory memory;
+	const WheelStateBlock* block;
+
+public:
+	StateReader();
+
+	bool open(const std::string& name = STATE_NAME);
+
+	// Single attempt - false if the writer was mid update
+	bool tryRead(WheelStateSnapshot& state) const;
+
+	// Retries until a consistent copy is made
+	bool read(WheelStateSnapshot& state) const;
+};
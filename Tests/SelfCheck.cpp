@@ -0,0 +1,313 @@
+/*
+Author: Andy Perrett
+Email: andy@wired-wrong.co.uk
+
+Version 0.1
+
+*/
+
+/*
+   Self checks for the parts that don't need a wheel - sequence file
+   parsing, trajectories and paths, rate trials, the force mailbox,
+   end-stops and the command queue. Nothing is sent to a device.
+
+   Build with every .cpp in SteeringWheel except SteeringWheel.cpp (that
+   has its own main) and link SDL2 as for the main program. Run from
+   this folder, or give the path of commands.seq:
+	SelfCheck [commands.seq]
+   Prints each failed check and exits non zero if there were any.
+*/
+
+#include <SDL.h>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../SteeringWheel/CommandQueue.h"
+#include "../SteeringWheel/EndStop.h"
+#include "../SteeringWheel/Mailbox.h"
+#include "../SteeringWheel/Rate.h"
+#include "../SteeringWheel/Sequence.h"
+#include "../SteeringWheel/Trajectory.h"
+
+constexpr size_t SEQUENCE_EVENTS = 38; // lines in commands.seq
+constexpr float CLOSE = 0.01f; // degrees or seconds
+constexpr auto QUEUE_PRODUCERS = 4;
+constexpr auto QUEUE_ITEMS = 100000; // per producer
+
+static int checks = 0;
+static int failures = 0;
+
+static void check(bool ok, const std::string& what)
+{
+	++checks;
+	if (ok) return;
+	++failures;
+	std::cout << "FAILED: " << what << std::endl;
+}
+
+static bool near(float a, float b, float within = CLOSE)
+{
+	return std::fabs(a - b) <= within;
+}
+
+// One bad line on its own must be refused
+static void checkBadLine(const std::string& line)
+{
+	const char* name = "selfcheck_bad.seq";
+	{
+		std::ofstream file(name);
+		file << line << std::endl;
+	}
+	Sequence sequence;
+	bool loaded = sequence.load(name);
+	check(!loaded && !sequence.getError().empty() && sequence.size() == 0, "sequence refuses: " + line);
+	std::remove(name);
+}
+
+static void checkSequence(const std::string& name)
+{
+	Sequence sequence;
+	bool loaded = sequence.load(name);
+	check(loaded, "sequence loads " + name + " " + sequence.getError());
+	check(sequence.size() == SEQUENCE_EVENTS, "sequence has one event per line of " + name);
+
+	checkBadLine("0 run NOSUCH");
+	checkBadLine("0 stop");
+	checkBadLine("0 gain");
+	checkBadLine("0 left 500 40000");
+	checkBadLine("0 right 500 -1");
+	checkBadLine("0 sine 1000 100 6000 SIDEWAYS");
+	checkBadLine("0 spring FOREVER 0 70000 65535 20000 20000");
+	checkBadLine("0 rampleft 1000 0 40000");
+	checkBadLine("0 goto");
+	checkBadLine("0 move");
+	checkBadLine("0 path");
+	checkBadLine("0 path 10@0");
+	checkBadLine("-5 gain 50");
+	checkBadLine("soon gain 50");
+	checkBadLine("0 jump 10");
+}
+
+// Sampled every mS - starts and ends at rest on the targets within the limits
+static void checkTrajectory(float from, float to, const MotionLimits& limits, const std::string& what)
+{
+	Trajectory move;
+	check(move.plan(from, to, limits), what + " plans");
+
+	float end = move.duration();
+	MotionPoint first = move.at(0.0f);
+	MotionPoint last = move.at(end);
+	check(near(first.position, from) && near(first.velocity, 0.0f), what + " starts at rest");
+	check(near(last.position, to) && near(last.velocity, 0.0f, 0.1f), what + " ends at rest on the target");
+	check(near(move.at(end + 1.0f).position, to), what + " stays on the target");
+	check(move.getPeakVelocity() <= limits.velocity * 1.001f, what + " peak velocity within the limit");
+
+	bool within = true;
+	bool onward = true;
+	float previous = from;
+	for (float t = 0.0f; t <= end; t += 0.001f)
+	{
+		MotionPoint p = move.at(t);
+		if (std::fabs(p.velocity) > limits.velocity * 1.001f) within = false;
+		if (std::fabs(p.acceleration) > limits.acceleration * 1.001f) within = false;
+		if ((to - from) * (p.position - previous) < -CLOSE) onward = false;
+		previous = p.position;
+	}
+	check(within, what + " velocity and acceleration within the limits");
+	check(onward, what + " never goes back");
+}
+
+static void checkMotion()
+{
+	MotionLimits limits = { 360.0f, PLAN_ACCELERATION, PLAN_JERK };
+	checkTrajectory(0.0f, 90.0f, limits, "S-curve move");
+	checkTrajectory(45.0f, -180.0f, limits, "S-curve move left");
+	checkTrajectory(0.0f, 0.5f, limits, "short move");
+	checkTrajectory(0.0f, 90.0f, { 360.0f, PLAN_ACCELERATION, 0.0f }, "trapezoidal move");
+
+	Trajectory still;
+	check(still.plan(10.0f, 10.0f, limits) && still.duration() == 0.0f && still.at(1.0f).position == 10.0f, "move of nothing");
+	check(!still.plan(0.0f, 90.0f, { 0.0f, PLAN_ACCELERATION, PLAN_JERK }), "move refuses no velocity");
+	check(!still.plan(0.0f, 90.0f, { 360.0f, PLAN_ACCELERATION, -1.0f }), "move refuses -ve jerk");
+
+	// Through each waypoint without stopping, at rest at the end
+	std::vector<Waypoint> waypoints(3);
+	waypoints[0].position = -45.0f;
+	waypoints[1].position = 45.0f;
+	waypoints[1].time = 0.4f;
+	waypoints[2].position = 0.0f;
+	Path path;
+	check(path.plan(0.0f, waypoints, limits), "path plans");
+	check(path.size() == waypoints.size(), "path has every waypoint");
+	bool through = true;
+	for (size_t i = 0; i < path.size(); ++i)
+	{
+		if (!near(path.at(path.arrival(i)).position, waypoints[i].position)) through = false;
+	}
+	check(through, "path passes through each waypoint");
+	check(path.arrival(1) - path.arrival(0) >= 0.4f - CLOSE, "path takes at least the time asked for");
+	MotionPoint end = path.at(path.duration());
+	check(near(end.position, 0.0f) && near(end.velocity, 0.0f), "path ends at rest");
+	check(near(path.at(0.0f).velocity, 0.0f), "path starts at rest");
+
+	Waypoint back;
+	back.position = 10.0f;
+	back.time = -1.0f;
+	check(!path.plan(0.0f, { back }, limits), "path refuses -ve time");
+	check(!path.plan(0.0f, waypoints, { 0.0f, PLAN_ACCELERATION, 0.0f }), "path refuses no velocity");
+}
+
+static void checkRates()
+{
+	// 100 calls of 100 uS in 100 mS - keeps up with 1000 Hz
+	std::vector<Uint64> steady(100, 100000);
+	RatePoint point = rateTrial(1000, 100000000, steady, 0);
+	check(point.sustained && near(point.achieved, 1000.0f, 1.0f) && near(point.growth, 1.0f), "steady rate sustained");
+	check(near(point.meanLatency, 100.0f) && near(point.p95Latency, 100.0f) && near(point.maxLatency, 100.0f), "steady rate latencies");
+
+	// Each call later than the last - the driver is queueing
+	std::vector<Uint64> growing;
+	for (Uint64 i = 0; i < 100; ++i) growing.push_back(100000 + i * 20000);
+	point = rateTrial(1000, 100000000, growing, 0);
+	check(!point.sustained && point.growth > RATE_GROWTH, "queueing rate not sustained");
+
+	std::vector<Uint64> slow(50, 100000);
+	check(!rateTrial(1000, 100000000, slow, 0).sustained, "half the rate not sustained");
+	std::vector<Uint64> refused(100, 100000);
+	check(!rateTrial(1000, 100000000, refused, 1).sustained, "refused command not sustained");
+	std::vector<Uint64> none;
+	point = rateTrial(1000, 100000000, none, 0);
+	check(!point.sustained && point.achieved == 0.0f, "no calls not sustained");
+
+	// One slot per interval, never waits
+	CommandRate rate;
+	rate.setRate(1000);
+	check(rate.getRate() == 1000, "command rate set");
+	Uint64 t = 1000000000;
+	check(rate.tryReserve(t), "first slot free");
+	check(!rate.tryReserve(t) && !rate.ready(t + 999999), "slot taken until the interval is up");
+	check(rate.ready(t + 1000000) && rate.tryReserve(t + 1000000), "next slot free after the interval");
+	check(rate.reserve(t + 1000000) == t + 2000000, "reserve waits for the next slot");
+	rate.setRate(RATE_UNLIMITED);
+	check(rate.tryReserve(t) && rate.tryReserve(t), "unlimited never refuses");
+}
+
+static void checkMailbox()
+{
+	ForceMailbox mailbox;
+	Sint16 level;
+	Uint64 posted;
+	check(!mailbox.pending() && !mailbox.take(level, posted), "mailbox starts empty");
+
+	mailbox.post(1000, 1000000);
+	mailbox.post(-2000, 2000000);
+	mailbox.post(-30000, 3000000);
+	check(mailbox.pending(), "mailbox pending after a post");
+	check(mailbox.take(level, posted) && level == -30000 && posted == 3000000, "mailbox takes the newest level and time");
+	check(!mailbox.pending() && !mailbox.take(level, posted), "mailbox empty once taken");
+
+	mailbox.sentAt(posted, 3500000);
+	MailboxStats stats = mailbox.getStats();
+	check(stats.posts == 3 && stats.sent == 1 && stats.coalesced == 2, "mailbox counts coalesced posts");
+	check(stats.lastLatency == 500 && stats.maxLatency == 500 && stats.meanLatency == 500, "mailbox latency");
+
+	mailbox.post(0, 4000000);
+	mailbox.reset();
+	check(!mailbox.pending() && mailbox.getStats().sent == 0, "mailbox reset");
+}
+
+static void checkEndStops()
+{
+	EndStops stops;
+	int level;
+	check(!stops.evaluate(120.0f, 120.0f, level) && level == 0, "end-stops off until configured");
+
+	stops.configure(-90.0f, 90.0f, 1000.0f, 2.0f, 20000);
+	check(stops.isEnabled(), "end-stops enabled");
+	check(!stops.evaluate(0.0f, 0.0f, level) && level == 0, "nothing inside the walls");
+
+	// 1 degree past the right wall - full stiffness plus the hysteresis, pushing left
+	check(stops.evaluate(91.0f, 91.0f, level) && level == -3000, "right wall pushes left");
+	stops.sent(level, 100);
+	check(!stops.evaluate(91.125f, 91.125f, level) && level == -3125, "small change not sent");
+	check(stops.evaluate(89.0f, 89.0f, level) && level == -1000, "fades inside the wall");
+	stops.sent(level, 3000);
+	check(stops.evaluate(87.9f, 87.9f, level) && level == 0, "lets go past the hysteresis");
+	stops.sent(level, 100);
+
+	check(stops.evaluate(-100.0f, -101.0f, level) && level == 12000, "left wall pushes right");
+	stops.sent(level, 100);
+	check(stops.evaluate(-200.0f, -200.0f, level) && level == 20000, "force limited to the maximum");
+	stops.sent(level, 100);
+
+	EndStopStats stats = stops.getStats();
+	check(stats.hits == 2 && stats.updates == 5, "end-stop hits and updates");
+	check(stats.overBudget == 1 && stats.maxReaction == 3000 && stats.lastReaction == 100, "end-stop reaction times");
+	check(near(stats.deepest, 110.0f), "end-stop depth is measured");
+
+	stops.disable();
+	check(!stops.isEnabled() && stops.evaluate(-200.0f, -200.0f, level) && level == 0, "disabled end-stops let go");
+}
+
+static void checkQueue()
+{
+	CommandQueue<int, 4> small;
+	int value;
+	check(small.empty() && !small.pop(value), "queue starts empty");
+	bool pushed = true;
+	for (int i = 0; i < 4; ++i) pushed = small.push(int(i)) && pushed;
+	check(pushed && !small.push(4), "queue full at its size");
+	bool order = true;
+	for (int i = 0; i < 4; ++i) order = small.pop(value) && value == i && order;
+	check(order && small.empty(), "queue pops in order");
+
+	// Many producers, one consumer - nothing lost and each producer in order
+	CommandQueue<int> queue;
+	std::vector<std::thread> producers;
+	for (int p = 0; p < QUEUE_PRODUCERS; ++p)
+	{
+		producers.emplace_back([&queue, p]()
+		{
+			for (int i = 0; i < QUEUE_ITEMS; ++i)
+			{
+				while (!queue.push(p * QUEUE_ITEMS + i)) std::this_thread::yield();
+			}
+		});
+	}
+
+	std::vector<int> next(QUEUE_PRODUCERS, 0);
+	int received = 0;
+	bool inOrder = true;
+	while (received < QUEUE_PRODUCERS * QUEUE_ITEMS)
+	{
+		if (!queue.pop(value))
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		int p = value / QUEUE_ITEMS;
+		if (p < 0 || p >= QUEUE_PRODUCERS || value % QUEUE_ITEMS != next[p]) inOrder = false;
+		else next[p]++;
+		++received;
+	}
+	for (auto& producer : producers) producer.join();
+	check(inOrder && queue.empty(), "queue keeps every producer's order");
+}
+
+int main(int argc, char* argv[])
+{
+	checkSequence(argc > 1 ? argv[1] : "commands.seq");
+	checkMotion();
+	checkRates();
+	checkMailbox();
+	checkEndStops();
+	checkQueue();
+
+	std::cout << checks - failures << " of " << checks << " checks passed" << std::endl;
+	return failures == 0 ? 0 : 1;
+}